@@ -0,0 +1,117 @@
+#include "aead.h"
+#include "aes.h"
+#include "aesni.h"
+#include "chacha20poly1305.h"
+#include "modes.h"
+
+#include <pthread.h>
+#include <string.h>
+
+static void aes256gcm_encrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	uint8_t tag[16])
+{
+	cf_aes_context aes;
+
+	cf_aes_init(&aes, key, 32);
+	cf_gcm_encrypt(&cf_aes, &aes, in, len, aad, aad_len, nonce, 12, out, tag, 16);
+	cf_aes_finish(&aes);
+}
+
+static int aes256gcm_decrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	const uint8_t tag[16],
+	uint8_t* out)
+{
+	cf_aes_context aes;
+
+	cf_aes_init(&aes, key, 32);
+	int err_decode = cf_gcm_decrypt(&cf_aes, &aes, in, len, aad, aad_len, nonce, 12, tag, 16, out);
+	cf_aes_finish(&aes);
+
+	return err_decode;
+}
+
+const struct aead aead_aes256gcm_portable =
+{
+	.name = "aes-256-gcm",
+	.label = "AES-256-GCM",
+	.encrypt = aes256gcm_encrypt,
+	.decrypt = aes256gcm_decrypt,
+};
+
+static const struct aead aead_aes256gcm_aesni =
+{
+	.name = "aes-256-gcm",
+	.label = "AES-256-GCM (AES-NI)",
+	.encrypt = aesni_gcm_encrypt,
+	.decrypt = aesni_gcm_decrypt,
+};
+
+static const struct aead aead_chacha20poly1305 =
+{
+	.name = "chacha20-poly1305",
+	.label = "ChaCha20-Poly1305",
+	.encrypt = cf_chacha20poly1305_encrypt,
+	.decrypt = cf_chacha20poly1305_decrypt,
+};
+
+static const struct aead* ciphers[AEAD_CIPHERS] =
+{
+	[AEAD_CHACHA20_POLY1305] = &aead_chacha20poly1305,
+	[AEAD_AES256_GCM] = &aead_aes256gcm_portable,
+};
+
+static pthread_once_t ciphers_once = PTHREAD_ONCE_INIT;
+
+// pick the fastest implementation of each cipher once
+static void ciphers_init(void)
+{
+	if (aesni_supported() == true)
+	{
+		ciphers[AEAD_AES256_GCM] = &aead_aes256gcm_aesni;
+	}
+}
+
+// returns NULL for unknown ciphers
+const struct aead* aead_get(int cipher)
+{
+	if ((cipher < 0) || (cipher >= AEAD_CIPHERS))
+	{
+		return NULL;
+	}
+
+	pthread_once(&ciphers_once, ciphers_init);
+
+	return ciphers[cipher];
+}
+
+// returns -1 for unknown names
+int aead_find(const char* name)
+{
+	for (int cipher = 0; cipher < AEAD_CIPHERS; ++cipher)
+	{
+		if (strcmp(aead_get(cipher)->name, name) == 0)
+		{
+			return cipher;
+		}
+	}
+
+	return -1;
+}
+
+bool aead_accelerated(int cipher)
+{
+	return aead_get(cipher) == &aead_aes256gcm_aesni;
+}
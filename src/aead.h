@@ -0,0 +1,54 @@
+#ifndef H_SSHRAM_AEAD
+#define H_SSHRAM_AEAD
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// authenticated ciphers available for the payload, identified in the
+// envelope by their index: they all use 256-bit keys, 96-bit nonces and
+// 128-bit tags, and decryption returns 0 when the tag matches
+//
+// AES-256-GCM uses AES-NI when the CPU has it, and cifra otherwise
+
+enum aead_cipher
+{
+	AEAD_CHACHA20_POLY1305 = 0,
+	AEAD_AES256_GCM = 1,
+};
+
+#define AEAD_CIPHERS 2
+
+struct aead
+{
+	// name used on the command line, and name printed
+	const char* name;
+	const char* label;
+	void (*encrypt)(
+		const uint8_t key[32],
+		const uint8_t nonce[12],
+		const uint8_t* aad,
+		size_t aad_len,
+		const uint8_t* in,
+		size_t len,
+		uint8_t* out,
+		uint8_t tag[16]);
+	int (*decrypt)(
+		const uint8_t key[32],
+		const uint8_t nonce[12],
+		const uint8_t* aad,
+		size_t aad_len,
+		const uint8_t* in,
+		size_t len,
+		const uint8_t tag[16],
+		uint8_t* out);
+};
+
+// the portable AES-256-GCM, only exposed for benchmarks
+extern const struct aead aead_aes256gcm_portable;
+
+const struct aead* aead_get(int cipher);
+int aead_find(const char* name);
+bool aead_accelerated(int cipher);
+
+#endif
@@ -0,0 +1,425 @@
+#include "aesni.h"
+#include "handy.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,pclmul,sse2,ssse3,sse4.1")))
+
+// GHASH works on byte-reflected blocks
+#define AESNI_BSWAP _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+struct aesni_gcm
+{
+	__m128i keys[15];
+	// powers of the hash key, from h to h^4
+	__m128i h[4];
+	__m128i j0;
+	int nonce[3];
+};
+
+bool aesni_supported(void)
+{
+	return __builtin_cpu_supports("aes")
+		&& __builtin_cpu_supports("pclmul")
+		&& __builtin_cpu_supports("sse4.1");
+}
+
+// k ^ (k << 32) ^ (k << 64) ^ (k << 96)
+AESNI_TARGET static inline __m128i expand_prefix(__m128i k)
+{
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, _mm_slli_si128(k, 8));
+}
+
+AESNI_TARGET static void expand_key(__m128i* keys, const uint8_t key[32])
+{
+	keys[0] = _mm_loadu_si128((const __m128i*) key);
+	keys[1] = _mm_loadu_si128((const __m128i*) (key + 16));
+
+	// the round constants must be immediates
+#define AESNI_EXPAND_EVEN(i, rcon) \
+	keys[i] = _mm_xor_si128( \
+		expand_prefix(keys[i - 2]), \
+		_mm_shuffle_epi32(_mm_aeskeygenassist_si128(keys[i - 1], rcon), 0xff))
+
+#define AESNI_EXPAND_ODD(i) \
+	keys[i] = _mm_xor_si128( \
+		expand_prefix(keys[i - 2]), \
+		_mm_shuffle_epi32(_mm_aeskeygenassist_si128(keys[i - 1], 0x00), 0xaa))
+
+	AESNI_EXPAND_EVEN(2, 0x01);
+	AESNI_EXPAND_ODD(3);
+	AESNI_EXPAND_EVEN(4, 0x02);
+	AESNI_EXPAND_ODD(5);
+	AESNI_EXPAND_EVEN(6, 0x04);
+	AESNI_EXPAND_ODD(7);
+	AESNI_EXPAND_EVEN(8, 0x08);
+	AESNI_EXPAND_ODD(9);
+	AESNI_EXPAND_EVEN(10, 0x10);
+	AESNI_EXPAND_ODD(11);
+	AESNI_EXPAND_EVEN(12, 0x20);
+	AESNI_EXPAND_ODD(13);
+	AESNI_EXPAND_EVEN(14, 0x40);
+
+#undef AESNI_EXPAND_EVEN
+#undef AESNI_EXPAND_ODD
+}
+
+AESNI_TARGET static inline __m128i aes_block(const __m128i* keys, __m128i block)
+{
+	block = _mm_xor_si128(block, keys[0]);
+
+	for (int i = 1; i < 14; ++i)
+	{
+		block = _mm_aesenc_si128(block, keys[i]);
+	}
+
+	return _mm_aesenclast_si128(block, keys[14]);
+}
+
+// four independent blocks keep the AES unit busy, they are kept in
+// registers rather than in an array which the compiler would not unroll
+AESNI_TARGET static inline void aes_blocks4(const __m128i* keys, __m128i* blocks)
+{
+	__m128i b0 = _mm_xor_si128(blocks[0], keys[0]);
+	__m128i b1 = _mm_xor_si128(blocks[1], keys[0]);
+	__m128i b2 = _mm_xor_si128(blocks[2], keys[0]);
+	__m128i b3 = _mm_xor_si128(blocks[3], keys[0]);
+
+	for (int i = 1; i < 14; ++i)
+	{
+		b0 = _mm_aesenc_si128(b0, keys[i]);
+		b1 = _mm_aesenc_si128(b1, keys[i]);
+		b2 = _mm_aesenc_si128(b2, keys[i]);
+		b3 = _mm_aesenc_si128(b3, keys[i]);
+	}
+
+	blocks[0] = _mm_aesenclast_si128(b0, keys[14]);
+	blocks[1] = _mm_aesenclast_si128(b1, keys[14]);
+	blocks[2] = _mm_aesenclast_si128(b2, keys[14]);
+	blocks[3] = _mm_aesenclast_si128(b3, keys[14]);
+}
+
+// carry-less multiplication in GF(2^128), from the Intel GCM white paper:
+// the 256-bit product is only reduced once for several blocks
+AESNI_TARGET static inline void clmul(__m128i a, __m128i b, __m128i* lo, __m128i* hi)
+{
+	__m128i mid = _mm_xor_si128(
+		_mm_clmulepi64_si128(a, b, 0x10),
+		_mm_clmulepi64_si128(a, b, 0x01));
+
+	*lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(mid, 8)));
+	*hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(mid, 8)));
+}
+
+AESNI_TARGET static inline __m128i reduce(__m128i lo, __m128i hi)
+{
+	__m128i t1;
+	__m128i t2;
+	__m128i t3;
+
+	// shift the 256-bit product left by one bit
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	// reduce modulo x^128 + x^7 + x^2 + x + 1
+	t1 = _mm_xor_si128(
+		_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+		_mm_slli_epi32(lo, 25));
+	t2 = _mm_srli_si128(t1, 4);
+	t1 = _mm_slli_si128(t1, 12);
+	lo = _mm_xor_si128(lo, t1);
+	t3 = _mm_xor_si128(
+		_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+		_mm_xor_si128(_mm_srli_epi32(lo, 7), t2));
+	lo = _mm_xor_si128(lo, t3);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+AESNI_TARGET static inline __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	clmul(a, b, &lo, &hi);
+
+	return reduce(lo, hi);
+}
+
+AESNI_TARGET static inline __m128i ghash(const struct aesni_gcm* gcm, __m128i x, __m128i block)
+{
+	return gfmul(_mm_xor_si128(x, _mm_shuffle_epi8(block, AESNI_BSWAP)), gcm->h[0]);
+}
+
+// ((((x ^ b0) h ^ b1) h ^ b2) h ^ b3) h = (x ^ b0) h^4 ^ b1 h^3 ^ b2 h^2 ^ b3 h
+AESNI_TARGET static inline __m128i ghash4(const struct aesni_gcm* gcm, __m128i x, const __m128i* blocks)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	x = _mm_xor_si128(x, _mm_shuffle_epi8(blocks[0], AESNI_BSWAP));
+	clmul(x, gcm->h[3], &lo, &hi);
+
+	for (int j = 1; j < 4; ++j)
+	{
+		clmul(_mm_shuffle_epi8(blocks[j], AESNI_BSWAP), gcm->h[3 - j], &lo, &hi);
+	}
+
+	return reduce(lo, hi);
+}
+
+// hash a buffer, zero-padded to a whole number of blocks
+AESNI_TARGET static __m128i ghash_buf(
+	const struct aesni_gcm* gcm,
+	__m128i x,
+	const uint8_t* buf,
+	size_t len)
+{
+	uint8_t last[16] = {0};
+
+	while (len >= 16)
+	{
+		x = ghash(gcm, x, _mm_loadu_si128((const __m128i*) buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	if (len > 0)
+	{
+		memcpy(last, buf, len);
+		x = ghash(gcm, x, _mm_loadu_si128((const __m128i*) last));
+	}
+
+	return x;
+}
+
+// the counter is the big-endian last word of the block
+AESNI_TARGET static inline __m128i counter(const struct aesni_gcm* gcm, uint32_t count)
+{
+	return _mm_set_epi32(
+		(int) __builtin_bswap32(count),
+		gcm->nonce[2],
+		gcm->nonce[1],
+		gcm->nonce[0]);
+}
+
+AESNI_TARGET static void gcm_init(
+	struct aesni_gcm* gcm,
+	const uint8_t key[32],
+	const uint8_t nonce[12])
+{
+	expand_key(gcm->keys, key);
+	memcpy(gcm->nonce, nonce, 12);
+
+	gcm->h[0] = _mm_shuffle_epi8(aes_block(gcm->keys, _mm_setzero_si128()), AESNI_BSWAP);
+
+	for (int i = 1; i < 4; ++i)
+	{
+		gcm->h[i] = gfmul(gcm->h[i - 1], gcm->h[0]);
+	}
+
+	gcm->j0 = aes_block(gcm->keys, counter(gcm, 1));
+}
+
+// CTR encryption or decryption, hashing the ciphertext on the way
+AESNI_TARGET static __m128i gcm_crypt(
+	const struct aesni_gcm* gcm,
+	__m128i x,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	bool decrypt)
+{
+	__m128i blocks[4];
+	__m128i data[4];
+	uint32_t count = 2;
+
+	while (len >= 64)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			blocks[j] = counter(gcm, count + j);
+			data[j] = _mm_loadu_si128((const __m128i*) (in + (16 * j)));
+		}
+
+		aes_blocks4(gcm->keys, blocks);
+
+		for (int j = 0; j < 4; ++j)
+		{
+			blocks[j] = _mm_xor_si128(blocks[j], data[j]);
+			_mm_storeu_si128((__m128i*) (out + (16 * j)), blocks[j]);
+		}
+
+		x = ghash4(gcm, x, decrypt ? data : blocks);
+
+		count += 4;
+		in += 64;
+		out += 64;
+		len -= 64;
+	}
+
+	while (len >= 16)
+	{
+		data[0] = _mm_loadu_si128((const __m128i*) in);
+		blocks[0] = _mm_xor_si128(aes_block(gcm->keys, counter(gcm, count)), data[0]);
+		_mm_storeu_si128((__m128i*) out, blocks[0]);
+		x = ghash(gcm, x, decrypt ? data[0] : blocks[0]);
+
+		++count;
+		in += 16;
+		out += 16;
+		len -= 16;
+	}
+
+	if (len > 0)
+	{
+		uint8_t stream[16];
+		uint8_t last[16] = {0};
+
+		_mm_storeu_si128((__m128i*) stream, aes_block(gcm->keys, counter(gcm, count)));
+
+		for (size_t i = 0; i < len; ++i)
+		{
+			last[i] = decrypt ? in[i] : (in[i] ^ stream[i]);
+			out[i] = in[i] ^ stream[i];
+		}
+
+		x = ghash(gcm, x, _mm_loadu_si128((const __m128i*) last));
+
+		mem_clean(stream, 16);
+		mem_clean(last, 16);
+	}
+
+	return x;
+}
+
+AESNI_TARGET static void gcm_tag(
+	const struct aesni_gcm* gcm,
+	__m128i x,
+	size_t aad_len,
+	size_t len,
+	uint8_t tag[16])
+{
+	uint8_t lengths[16];
+	uint64_t aad_bits = ((uint64_t) aad_len) * 8;
+	uint64_t bits = ((uint64_t) len) * 8;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		lengths[i] = (aad_bits >> (56 - (8 * i))) & 0xff;
+		lengths[8 + i] = (bits >> (56 - (8 * i))) & 0xff;
+	}
+
+	x = ghash(gcm, x, _mm_loadu_si128((const __m128i*) lengths));
+	x = _mm_xor_si128(_mm_shuffle_epi8(x, AESNI_BSWAP), gcm->j0);
+
+	_mm_storeu_si128((__m128i*) tag, x);
+}
+
+AESNI_TARGET void aesni_gcm_encrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	uint8_t tag[16])
+{
+	struct aesni_gcm gcm;
+	__m128i x = _mm_setzero_si128();
+
+	gcm_init(&gcm, key, nonce);
+
+	x = ghash_buf(&gcm, x, aad, aad_len);
+	x = gcm_crypt(&gcm, x, in, len, out, false);
+	gcm_tag(&gcm, x, aad_len, len, tag);
+
+	mem_clean(&gcm, sizeof (gcm));
+}
+
+// the plaintext is wiped if the tag does not match
+AESNI_TARGET int aesni_gcm_decrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	const uint8_t tag[16],
+	uint8_t* out)
+{
+	struct aesni_gcm gcm;
+	__m128i x = _mm_setzero_si128();
+	uint8_t expected[16];
+	uint8_t diff = 0;
+
+	gcm_init(&gcm, key, nonce);
+
+	x = ghash_buf(&gcm, x, aad, aad_len);
+	x = gcm_crypt(&gcm, x, in, len, out, true);
+	gcm_tag(&gcm, x, aad_len, len, expected);
+
+	mem_clean(&gcm, sizeof (gcm));
+
+	// constant-time comparison
+	for (int i = 0; i < 16; ++i)
+	{
+		diff |= expected[i] ^ tag[i];
+	}
+
+	if (diff != 0)
+	{
+		mem_clean(out, len);
+		return 1;
+	}
+
+	return 0;
+}
+
+#else
+
+bool aesni_supported(void)
+{
+	return false;
+}
+
+void aesni_gcm_encrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	uint8_t tag[16])
+{
+}
+
+int aesni_gcm_decrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	const uint8_t tag[16],
+	uint8_t* out)
+{
+	return 1;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef H_SSHRAM_AESNI
+#define H_SSHRAM_AESNI
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// AES-256-GCM with the AES-NI and PCLMULQDQ instructions, with the same
+// interface as the cifra AEADs: these functions must only be called when
+// aesni_supported() returns true
+
+bool aesni_supported(void);
+void aesni_gcm_encrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	uint8_t tag[16]);
+int aesni_gcm_decrypt(
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	size_t aad_len,
+	const uint8_t* in,
+	size_t len,
+	const uint8_t tag[16],
+	uint8_t* out);
+
+#endif
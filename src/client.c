@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+
+#include "client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CLIENT_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+static int client_receive(int sock, uint64_t* len)
+{
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof (int))];
+	} control;
+
+	struct iovec iov =
+	{
+		.iov_base = len,
+		.iov_len = sizeof (uint64_t),
+	};
+
+	struct msghdr msg =
+	{
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof (control.buf),
+	};
+
+	ssize_t size;
+
+	do
+	{
+		size = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	}
+	while ((size == -1) && (errno == EINTR));
+
+	if (size == -1)
+	{
+		return -1;
+	}
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+	if ((size != sizeof (uint64_t))
+		|| (cmsg == NULL)
+		|| (cmsg->cmsg_level != SOL_SOCKET)
+		|| (cmsg->cmsg_type != SCM_RIGHTS)
+		|| (cmsg->cmsg_len != CMSG_LEN(sizeof (int))))
+	{
+		errno = EPROTO;
+		return -1;
+	}
+
+	int fd;
+
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof (int));
+
+	return fd;
+}
+
+int sshram_client_fetch(const char* path, struct sshram_key* key)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+	if (strlen(path) >= sizeof (addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (sock == -1)
+	{
+		return -1;
+	}
+
+	if (connect(sock, (struct sockaddr*) &addr, sizeof (addr)) == -1)
+	{
+		close(sock);
+		return -1;
+	}
+
+	uint64_t len;
+	int fd = client_receive(sock, &len);
+	int err = errno;
+
+	close(sock);
+
+	if (fd == -1)
+	{
+		errno = err;
+		return -1;
+	}
+
+	// only accept a memfd that can never change under our feet
+	struct stat file_info;
+	int seals = fcntl(fd, F_GET_SEALS);
+
+	if ((seals == -1)
+		|| ((seals & CLIENT_SEALS) != CLIENT_SEALS)
+		|| (fstat(fd, &file_info) == -1)
+		|| (len == 0)
+		|| ((uint64_t) file_info.st_size != len))
+	{
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+
+	void* buf = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (buf == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	// failing is fine here, the pages are already locked by the server
+	mlock(buf, len);
+
+	key->buf = buf;
+	key->len = len;
+
+	return 0;
+}
+
+void sshram_client_release(struct sshram_key* key)
+{
+	if (key->buf != NULL)
+	{
+		munlock(key->buf, key->len);
+		munmap((void*) key->buf, key->len);
+	}
+
+	key->buf = NULL;
+	key->len = 0;
+}
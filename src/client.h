@@ -0,0 +1,24 @@
+#ifndef H_SSHRAM_CLIENT
+#define H_SSHRAM_CLIENT
+
+#include <stddef.h>
+#include <stdint.h>
+
+// client library for the Unix socket mode of sshram (`sshram -u [socket]`):
+// the private key is received as a sealed, read-only memfd and mapped
+// without any copy, so it can be used straight away and then released
+//
+// the server sends the length of the private key as a native 64 bits
+// integer, along with the memfd as SCM_RIGHTS ancillary data
+
+struct sshram_key
+{
+	const uint8_t* buf;
+	size_t len;
+};
+
+// returns 0 on success, or -1 with errno set
+int sshram_client_fetch(const char* path, struct sshram_key* key);
+void sshram_client_release(struct sshram_key* key);
+
+#endif
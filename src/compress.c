@@ -0,0 +1,74 @@
+#include "compress.h"
+#include "lz4.h"
+
+size_t compress_bound(size_t len)
+{
+	if (len > LZ4_MAX_INPUT_SIZE)
+	{
+		return 0;
+	}
+
+	return COMPRESS_HEADER_LEN + LZ4_compressBound(len);
+}
+
+// returns 0 if the data could not be compressed or did not shrink
+size_t compress_payload(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len)
+{
+	if ((len > LZ4_MAX_INPUT_SIZE) || (dst_len <= COMPRESS_HEADER_LEN))
+	{
+		return 0;
+	}
+
+	int size = LZ4_compress_default(
+		(const char*) src,
+		(char*) (dst + COMPRESS_HEADER_LEN),
+		len,
+		dst_len - COMPRESS_HEADER_LEN);
+
+	if ((size <= 0) || ((COMPRESS_HEADER_LEN + (size_t) size) >= len))
+	{
+		return 0;
+	}
+
+	dst[0] = len & 0xff;
+	dst[1] = (len >> 8) & 0xff;
+	dst[2] = (len >> 16) & 0xff;
+	dst[3] = (len >> 24) & 0xff;
+
+	return COMPRESS_HEADER_LEN + size;
+}
+
+// returns 0 if the length is not plausible for this payload
+size_t compress_original_len(const uint8_t* src, size_t len)
+{
+	if (len <= COMPRESS_HEADER_LEN)
+	{
+		return 0;
+	}
+
+	size_t original = ((size_t) src[0])
+		| (((size_t) src[1]) << 8)
+		| (((size_t) src[2]) << 16)
+		| (((size_t) src[3]) << 24);
+
+	// LZ4 cannot expand data more than 255 times
+	if ((original > LZ4_MAX_INPUT_SIZE)
+		|| (original > (255 * (len - COMPRESS_HEADER_LEN))))
+	{
+		return 0;
+	}
+
+	return original;
+}
+
+// dst_len must be the original length
+bool compress_inflate(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len)
+{
+	int size = LZ4_decompress_safe(
+		(const char*) (src + COMPRESS_HEADER_LEN),
+		(char*) dst,
+		len - COMPRESS_HEADER_LEN,
+		dst_len);
+
+	return (size >= 0) && ((size_t) size == dst_len);
+}
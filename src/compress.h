@@ -0,0 +1,20 @@
+#ifndef H_SSHRAM_COMPRESS
+#define H_SSHRAM_COMPRESS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// optional LZ4 stage applied to the payload before encryption:
+// the compressed payload starts with the little-endian length
+// of the original data, so it can be decompressed in one pass
+// into a buffer of the right size
+
+#define COMPRESS_HEADER_LEN 4
+
+size_t compress_bound(size_t len);
+size_t compress_payload(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len);
+size_t compress_original_len(const uint8_t* src, size_t len);
+bool compress_inflate(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len);
+
+#endif
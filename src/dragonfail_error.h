@@ -6,16 +6,32 @@ enum dgn_error
 	DGN_OK, // do not remove
 
 	SSHRAM_ERR_ARG_NAME,
+	SSHRAM_ERR_ARG_SLOT,
+	SSHRAM_ERR_ARG_FUSE,
+	SSHRAM_ERR_ARG_SOCKET,
+	SSHRAM_ERR_ARG_PASS_FD,
+	SSHRAM_ERR_ARG_JOBS,
+	SSHRAM_ERR_ARG_CIPHER,
+	SSHRAM_ERR_ARG_BENCH,
+	SSHRAM_ERR_ARG_VERIFY,
 	SSHRAM_ERR_ARG_DECODED,
 	SSHRAM_ERR_ARG_DECODED_OPEN,
 	SSHRAM_ERR_ARG_ENCODED,
 	SSHRAM_ERR_ARG_ENCODED_OPEN,
+	SSHRAM_ERR_ARG_MANY,
+	SSHRAM_ERR_ARG_NAMES,
+	SSHRAM_ERR_ARG_LAZY,
+	SSHRAM_ERR_ARG_QUEUE,
+	SSHRAM_ERR_ARG_ASKPASS,
+	SSHRAM_ERR_ARG_MEDIA,
+	SSHRAM_ERR_ARG_MEDIA_USE,
 
 	SSHRAM_ERR_RNG,
 	SSHRAM_ERR_ARGON2,
 
 	SSHRAM_ERR_MALLOC,
 	SSHRAM_ERR_MLOCK,
+	SSHRAM_ERR_MLOCK_LIMIT,
 
 	SSHRAM_ERR_ENV,
 	SSHRAM_ERR_FGETS,
@@ -23,17 +39,36 @@ enum dgn_error
 	SSHRAM_ERR_FTELL,
 	SSHRAM_ERR_FREAD,
 	SSHRAM_ERR_FWRITE,
+	SSHRAM_ERR_FSYNC,
 	SSHRAM_ERR_TERMIOS,
 
 	SSHRAM_ERR_ENC_PASS_LEN,
 	SSHRAM_ERR_ENC_PASS_MATCH,
+	SSHRAM_ERR_ENC_BUF_LEN,
+	SSHRAM_ERR_ENC_CIPHER,
+
+	SSHRAM_ERR_REKEY_LEGACY,
+	SSHRAM_ERR_REKEY_SLOTS_FULL,
+
+	SSHRAM_ERR_VERIFY_EMPTY,
+	SSHRAM_ERR_VERIFY_FAILED,
+
+	SSHRAM_ERR_BENCH_MISMATCH,
+	SSHRAM_ERR_BENCH_THREAD,
 
 	SSHRAM_ERR_DEC_CHACHAPOLY,
+	SSHRAM_ERR_DEC_UNWRAP,
+	SSHRAM_ERR_DEC_FLAGS,
+	SSHRAM_ERR_DEC_INFLATE,
+	SSHRAM_ERR_DEC_SEALED,
 	SSHRAM_ERR_DEC_PATH_LEN,
 	SSHRAM_ERR_DEC_PASUNEPIPE,
+	SSHRAM_ERR_DEC_PIPE_NAME,
 	SSHRAM_ERR_DEC_MKFIFO,
 	SSHRAM_ERR_DEC_PIPE_FOPEN,
 	SSHRAM_ERR_DEC_PIPE_FWRITE,
+	SSHRAM_ERR_DEC_PIPE_POLL,
+	SSHRAM_ERR_DEC_PIPE_IOCTL,
 	SSHRAM_ERR_DEC_PIPE_FCLOSE,
 	SSHRAM_ERR_DEC_PIPE_UNLINK,
 	SSHRAM_ERR_DEC_INOTIFY_INIT,
@@ -41,6 +76,14 @@ enum dgn_error
 	SSHRAM_ERR_DEC_INOTIFY_READ,
 	SSHRAM_ERR_DEC_INOTIFY_READ_INT,
 	SSHRAM_ERR_DEC_SIGACTION,
+	SSHRAM_ERR_DEC_LOG_THREAD,
+	SSHRAM_ERR_DEC_FUSE,
+	SSHRAM_ERR_DEC_FUSE_MISSING,
+	SSHRAM_ERR_DEC_SOCKET,
+	SSHRAM_ERR_DEC_MEMFD,
+	SSHRAM_ERR_MEDIA_ROOT,
+	SSHRAM_ERR_MEDIA_READ,
+	SSHRAM_ERR_MEDIA_HEADER,
 
 	DGN_SIZE, // do not remove
 };
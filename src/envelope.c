@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include "argon2.h"
+#include "chacha20poly1305.h"
+#include "dragonfail.h"
+#include "envelope.h"
+#include "handy.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// shared state of the key slots trial derivation
+struct unlock
+{
+	const struct envelope_slot* slots;
+	const char* pass;
+	pthread_mutex_t mutex;
+	// the key slots to try, with locked scratch keys for each of them
+	int order[ENVELOPE_SLOTS];
+	struct unlock_keys* keys;
+	int found;
+	uint8_t* dek;
+	uint8_t* kek;
+};
+
+// shared state of the chunks encryption and decryption
+struct chunks
+{
+	const struct aead* aead;
+	const uint8_t* key;
+	const uint8_t* nonce;
+	const uint8_t* aad;
+	const uint8_t* in;
+	uint8_t* out;
+	size_t len;
+	size_t count;
+	pthread_mutex_t mutex;
+	bool failed;
+};
+
+struct unlock_keys
+{
+	uint8_t kek[32];
+	uint8_t dek[32];
+};
+
+// little-endian serialization helpers
+static void put_u32(uint8_t* buf, uint32_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+	buf[2] = (val >> 16) & 0xff;
+	buf[3] = (val >> 24) & 0xff;
+}
+
+static uint32_t get_u32(const uint8_t* buf)
+{
+	return ((uint32_t) buf[0])
+		| (((uint32_t) buf[1]) << 8)
+		| (((uint32_t) buf[2]) << 16)
+		| (((uint32_t) buf[3]) << 24);
+}
+
+// the KDF parameters are authenticated when wrapping the data key
+static void slot_params(const struct envelope_slot* slot, uint8_t* buf)
+{
+	memcpy(buf, slot->salt, 16);
+	put_u32(buf + 16, slot->t_cost);
+	put_u32(buf + 20, slot->m_cost);
+	put_u32(buf + 24, slot->lanes);
+}
+
+static void slot_write(const struct envelope_slot* slot, uint8_t* buf)
+{
+	slot_params(slot, buf);
+	memcpy(buf + 28, slot->nonce, 12);
+	memcpy(buf + 40, slot->key, 32);
+	memcpy(buf + 72, slot->tag, 16);
+}
+
+static void slot_read(struct envelope_slot* slot, const uint8_t* buf)
+{
+	memcpy(slot->salt, buf, 16);
+	slot->t_cost = get_u32(buf + 16);
+	slot->m_cost = get_u32(buf + 20);
+	slot->lanes = get_u32(buf + 24);
+	memcpy(slot->nonce, buf + 28, 12);
+	memcpy(slot->key, buf + 40, 32);
+	memcpy(slot->tag, buf + 72, 16);
+}
+
+bool envelope_detect(const uint8_t* buf, size_t len)
+{
+	return (len >= ENVELOPE_HEADER_LEN)
+		&& (memcmp(buf, ENVELOPE_MAGIC, ENVELOPE_MAGIC_LEN) == 0)
+		&& (buf[ENVELOPE_MAGIC_LEN] == ENVELOPE_VERSION);
+}
+
+void envelope_read(struct envelope* envelope, const uint8_t* buf)
+{
+	envelope->flags = buf[ENVELOPE_MAGIC_LEN + 1] & ~ENVELOPE_CIPHER_MASK;
+	envelope->cipher = (buf[ENVELOPE_MAGIC_LEN + 1] & ENVELOPE_CIPHER_MASK) >> ENVELOPE_CIPHER_SHIFT;
+	memcpy(envelope->nonce, buf + ENVELOPE_AAD_LEN, 12);
+	memcpy(envelope->tag, buf + ENVELOPE_AAD_LEN + 12, 16);
+	envelope->active = buf[ENVELOPE_ACTIVE_OFFSET] & 1;
+
+	for (uint8_t table = 0; table < 2; ++table)
+	{
+		for (int i = 0; i < ENVELOPE_SLOTS; ++i)
+		{
+			slot_read(
+				&(envelope->tables[table][i]),
+				buf + envelope_table_offset(table) + (i * ENVELOPE_SLOT_LEN));
+		}
+	}
+}
+
+void envelope_write(const struct envelope* envelope, uint8_t* buf)
+{
+	memset(buf, 0, ENVELOPE_HEADER_LEN);
+	memcpy(buf, ENVELOPE_MAGIC, ENVELOPE_MAGIC_LEN);
+	buf[ENVELOPE_MAGIC_LEN] = ENVELOPE_VERSION;
+	buf[ENVELOPE_MAGIC_LEN + 1] = envelope->flags
+		| ((envelope->cipher << ENVELOPE_CIPHER_SHIFT) & ENVELOPE_CIPHER_MASK);
+	memcpy(buf + ENVELOPE_AAD_LEN, envelope->nonce, 12);
+	memcpy(buf + ENVELOPE_AAD_LEN + 12, envelope->tag, 16);
+	buf[ENVELOPE_ACTIVE_OFFSET] = envelope->active;
+
+	envelope_write_table(envelope, 0, buf + envelope_table_offset(0));
+	envelope_write_table(envelope, 1, buf + envelope_table_offset(1));
+}
+
+void envelope_write_table(const struct envelope* envelope, uint8_t table, uint8_t* buf)
+{
+	for (int i = 0; i < ENVELOPE_SLOTS; ++i)
+	{
+		slot_write(&(envelope->tables[table][i]), buf + (i * ENVELOPE_SLOT_LEN));
+	}
+}
+
+size_t envelope_table_offset(uint8_t table)
+{
+	return ENVELOPE_TABLES_OFFSET + (table * ENVELOPE_TABLE_LEN);
+}
+
+bool envelope_slot_used(const struct envelope_slot* slot)
+{
+	return slot->t_cost != 0;
+}
+
+// slots with the same salt and KDF parameters derive the same key
+bool envelope_slot_same_kdf(
+	const struct envelope_slot* a,
+	const struct envelope_slot* b)
+{
+	return (memcmp(a->salt, b->salt, 16) == 0)
+		&& (a->t_cost == b->t_cost)
+		&& (a->m_cost == b->m_cost)
+		&& (a->lanes == b->lanes);
+}
+
+// does not throw so it can run in worker threads
+bool envelope_slot_try_derive(
+	const struct envelope_slot* slot,
+	const char* pass,
+	uint8_t kek[32])
+{
+	int err_hash = argon2i_hash_raw(
+		slot->t_cost,
+		slot->m_cost,
+		slot->lanes,
+		pass,
+		strlen(pass),
+		slot->salt,
+		16,
+		kek,
+		32);
+
+	return err_hash == ARGON2_OK;
+}
+
+void envelope_slot_derive(
+	const struct envelope_slot* slot,
+	const char* pass,
+	uint8_t kek[32])
+{
+	if (envelope_slot_try_derive(slot, pass, kek) == false)
+	{
+		dgn_throw(SSHRAM_ERR_ARGON2);
+	}
+}
+
+// the slot nonce must be freshly generated by the caller
+void envelope_slot_wrap(
+	struct envelope_slot* slot,
+	const uint8_t kek[32],
+	const uint8_t dek[32])
+{
+	uint8_t params[28];
+
+	slot_params(slot, params);
+
+	cf_chacha20poly1305_encrypt(
+		kek,
+		slot->nonce,
+		params,
+		28,
+		dek,
+		32,
+		slot->key,
+		slot->tag);
+}
+
+bool envelope_slot_unwrap(
+	const struct envelope_slot* slot,
+	const uint8_t kek[32],
+	uint8_t dek[32])
+{
+	uint8_t params[28];
+
+	slot_params(slot, params);
+
+	int err_decode = cf_chacha20poly1305_decrypt(
+		kek,
+		slot->nonce,
+		params,
+		28,
+		slot->key,
+		32,
+		slot->tag,
+		dek);
+
+	return err_decode == 0;
+}
+
+size_t envelope_chunked_len(size_t len)
+{
+	size_t count = (len + ENVELOPE_CHUNK_LEN - 1) / ENVELOPE_CHUNK_LEN;
+
+	return len + (count * ENVELOPE_CHUNK_TAG_LEN);
+}
+
+// returns 0 if the chunked payload length is not valid
+size_t envelope_chunked_plain_len(size_t len)
+{
+	size_t full = ENVELOPE_CHUNK_LEN + ENVELOPE_CHUNK_TAG_LEN;
+	size_t last = len % full;
+
+	// the last chunk holds at least one byte
+	if ((last != 0) && (last <= ENVELOPE_CHUNK_TAG_LEN))
+	{
+		return 0;
+	}
+
+	size_t count = (len + full - 1) / full;
+
+	return len - (count * ENVELOPE_CHUNK_TAG_LEN);
+}
+
+// the chunk index is mixed into the last 8 bytes of the payload nonce,
+// and the final chunk flag is appended to the additional data
+static void chunk_params(
+	const struct chunks* chunks,
+	size_t index,
+	uint8_t nonce[12],
+	uint8_t aad[ENVELOPE_AAD_LEN + 1])
+{
+	memcpy(nonce, chunks->nonce, 12);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		nonce[4 + i] ^= (((uint64_t) index) >> (8 * i)) & 0xff;
+	}
+
+	memcpy(aad, chunks->aad, ENVELOPE_AAD_LEN);
+	aad[ENVELOPE_AAD_LEN] = (index == (chunks->count - 1)) ? 1 : 0;
+}
+
+static void chunk_encrypt(void* data, size_t index)
+{
+	struct chunks* chunks = (struct chunks*) data;
+	uint8_t nonce[12];
+	uint8_t aad[ENVELOPE_AAD_LEN + 1];
+	size_t offset = index * ENVELOPE_CHUNK_LEN;
+	size_t size = MIN(ENVELOPE_CHUNK_LEN, chunks->len - offset);
+	uint8_t* out = chunks->out + (index * (ENVELOPE_CHUNK_LEN + ENVELOPE_CHUNK_TAG_LEN));
+
+	chunk_params(chunks, index, nonce, aad);
+
+	chunks->aead->encrypt(
+		chunks->key,
+		nonce,
+		aad,
+		ENVELOPE_AAD_LEN + 1,
+		chunks->in + offset,
+		size,
+		out,
+		out + size);
+}
+
+static void chunk_decrypt(void* data, size_t index)
+{
+	struct chunks* chunks = (struct chunks*) data;
+	uint8_t nonce[12];
+	uint8_t aad[ENVELOPE_AAD_LEN + 1];
+	size_t offset = index * ENVELOPE_CHUNK_LEN;
+	size_t size = MIN(ENVELOPE_CHUNK_LEN, chunks->len - offset);
+	const uint8_t* in = chunks->in + (index * (ENVELOPE_CHUNK_LEN + ENVELOPE_CHUNK_TAG_LEN));
+
+	chunk_params(chunks, index, nonce, aad);
+
+	int err_decode = chunks->aead->decrypt(
+		chunks->key,
+		nonce,
+		aad,
+		ENVELOPE_AAD_LEN + 1,
+		in,
+		size,
+		in + size,
+		chunks->out + offset);
+
+	if (err_decode != 0)
+	{
+		pthread_mutex_lock(&(chunks->mutex));
+		chunks->failed = true;
+		pthread_mutex_unlock(&(chunks->mutex));
+	}
+}
+
+// the output buffer must be envelope_chunked_len(len) bytes long,
+// and the additional data ENVELOPE_AAD_LEN bytes long
+void envelope_encrypt_chunks(
+	const struct aead* aead,
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	int jobs)
+{
+	struct chunks chunks =
+	{
+		.aead = aead,
+		.key = key,
+		.nonce = nonce,
+		.aad = aad,
+		.in = in,
+		.out = out,
+		.len = len,
+		.count = (len + ENVELOPE_CHUNK_LEN - 1) / ENVELOPE_CHUNK_LEN,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.failed = false,
+	};
+
+	pool_run(jobs, chunks.count, chunk_encrypt, &chunks);
+	pthread_mutex_destroy(&(chunks.mutex));
+}
+
+// the output buffer must be envelope_chunked_plain_len(len) bytes long
+bool envelope_decrypt_chunks(
+	const struct aead* aead,
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	int jobs)
+{
+	size_t plain_len = envelope_chunked_plain_len(len);
+
+	if (plain_len == 0)
+	{
+		return false;
+	}
+
+	struct chunks chunks =
+	{
+		.aead = aead,
+		.key = key,
+		.nonce = nonce,
+		.aad = aad,
+		.in = in,
+		.out = out,
+		.len = plain_len,
+		.count = (plain_len + ENVELOPE_CHUNK_LEN - 1) / ENVELOPE_CHUNK_LEN,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.failed = false,
+	};
+
+	pool_run(jobs, chunks.count, chunk_decrypt, &chunks);
+	pthread_mutex_destroy(&(chunks.mutex));
+
+	return chunks.failed == false;
+}
+
+// try a key slot, unless one of a lower index already unwrapped the data key:
+// the slots are in ascending order, so the lowest matching one always wins
+static void unlock_slot(void* data, size_t index)
+{
+	struct unlock* unlock = (struct unlock*) data;
+	struct unlock_keys* keys = &(unlock->keys[index]);
+	int current = unlock->order[index];
+	const struct envelope_slot* slot = &(unlock->slots[current]);
+
+	pthread_mutex_lock(&(unlock->mutex));
+	bool found = (unlock->found != -1) && (unlock->found < current);
+	pthread_mutex_unlock(&(unlock->mutex));
+
+	if (found == true)
+	{
+		return;
+	}
+
+	if ((envelope_slot_try_derive(slot, unlock->pass, keys->kek) == true)
+		&& (envelope_slot_unwrap(slot, keys->kek, keys->dek) == true))
+	{
+		pthread_mutex_lock(&(unlock->mutex));
+
+		if ((unlock->found == -1) || (unlock->found > current))
+		{
+			unlock->found = current;
+			memcpy(unlock->dek, keys->dek, 32);
+
+			if (unlock->kek != NULL)
+			{
+				memcpy(unlock->kek, keys->kek, 32);
+			}
+		}
+
+		pthread_mutex_unlock(&(unlock->mutex));
+	}
+
+	mem_clean(keys->kek, 32);
+	mem_clean(keys->dek, 32);
+}
+
+// unwrap the data key with the first matching key slot of the active table,
+// deriving the password for every used slot in parallel (on as many threads
+// as there are cores and memory for Argon2) unless given a hint: whichever
+// trial finishes first, the matching slot of the lowest index is returned
+// the derived password is also returned if kek is not NULL
+int envelope_unlock(
+	const struct envelope* envelope,
+	const char* pass,
+	int hint,
+	uint8_t dek[32],
+	uint8_t kek[32])
+{
+	struct unlock_keys keys[ENVELOPE_SLOTS];
+
+	struct unlock unlock =
+	{
+		.slots = envelope->tables[envelope->active],
+		.pass = pass,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.keys = keys,
+		.found = -1,
+		.dek = dek,
+		.kek = kek,
+	};
+
+	int used = 0;
+
+	// only try the given slot
+	if (hint >= 0)
+	{
+		if ((hint >= ENVELOPE_SLOTS)
+			|| (envelope_slot_used(&(unlock.slots[hint])) == false))
+		{
+			return -1;
+		}
+
+		unlock.order[used] = hint;
+		++used;
+	}
+	else
+	{
+		for (int i = 0; i < ENVELOPE_SLOTS; ++i)
+		{
+			if (envelope_slot_used(&(unlock.slots[i])) == true)
+			{
+				unlock.order[used] = i;
+				++used;
+			}
+		}
+	}
+
+	if (used == 0)
+	{
+		return -1;
+	}
+
+	uint64_t m_cost = 0;
+
+	for (int i = 0; i < used; ++i)
+	{
+		m_cost = MAX(m_cost, unlock.slots[unlock.order[i]].m_cost);
+	}
+
+	int err_mlock = mlock(keys, sizeof (keys));
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return -1;
+	}
+
+	// argon2 memory costs are in KiB
+	pool_run(pool_jobs_fit(0, m_cost * 1024), used, unlock_slot, &unlock);
+
+	munlock(keys, sizeof (keys));
+	pthread_mutex_destroy(&(unlock.mutex));
+
+	return unlock.found;
+}
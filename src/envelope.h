@@ -0,0 +1,132 @@
+#ifndef H_SSHRAM_ENVELOPE
+#define H_SSHRAM_ENVELOPE
+
+#include "aead.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the payload is encrypted with a random data key, which is itself wrapped
+// by the password-derived key in a key slot: changing the password only
+// rewrites a slot, and never touches the payload
+//
+// several key slots, each with its own salt and KDF parameters, can wrap
+// the same data key so any of their passwords unlocks the payload
+//
+// key slots are stored in two tables, the active one being selected by a
+// single byte, so a slot can be rewritten atomically by filling the inactive
+// table and then flipping this byte
+
+#define ENVELOPE_MAGIC "sshram"
+#define ENVELOPE_MAGIC_LEN 6
+#define ENVELOPE_VERSION 2
+
+#define ENVELOPE_T_COST 100
+#define ENVELOPE_M_COST (1 << 16)
+#define ENVELOPE_LANES 1
+
+#define ENVELOPE_SLOTS 8
+#define ENVELOPE_SLOT_LEN (16 + 4 + 4 + 4 + 12 + 32 + 16)
+#define ENVELOPE_TABLE_LEN (ENVELOPE_SLOTS * ENVELOPE_SLOT_LEN)
+
+// payload flags
+#define ENVELOPE_FLAG_LZ4 (1 << 0)
+#define ENVELOPE_FLAG_CHUNKED (1 << 1)
+#define ENVELOPE_FLAGS_KNOWN (ENVELOPE_FLAG_LZ4 | ENVELOPE_FLAG_CHUNKED)
+
+// the payload cipher (see aead.h) is stored in two bits of the flags byte,
+// so it is authenticated and older versions reject unknown ciphers
+#define ENVELOPE_CIPHER_SHIFT 2
+#define ENVELOPE_CIPHER_MASK (3 << ENVELOPE_CIPHER_SHIFT)
+
+// payloads larger than a chunk are split into independently authenticated
+// chunks, encrypted and decrypted in parallel: the nonce of each chunk is
+// derived from the payload nonce and the chunk index, and the last chunk is
+// marked in its additional data so truncated payloads are always rejected
+#define ENVELOPE_CHUNK_LEN (1 << 20)
+#define ENVELOPE_CHUNK_TAG_LEN 16
+
+// magic, version and flags are authenticated with the payload
+#define ENVELOPE_AAD_LEN (ENVELOPE_MAGIC_LEN + 1 + 1)
+#define ENVELOPE_ACTIVE_OFFSET (ENVELOPE_AAD_LEN + 12 + 16)
+#define ENVELOPE_TABLES_OFFSET (ENVELOPE_ACTIVE_OFFSET + 4)
+#define ENVELOPE_HEADER_LEN (ENVELOPE_TABLES_OFFSET + (2 * ENVELOPE_TABLE_LEN))
+
+struct envelope_slot
+{
+	uint8_t salt[16];
+	uint32_t t_cost;
+	uint32_t m_cost;
+	uint32_t lanes;
+	uint8_t nonce[12];
+	uint8_t key[32];
+	uint8_t tag[16];
+};
+
+struct envelope
+{
+	uint8_t flags;
+	uint8_t cipher;
+	uint8_t active;
+	uint8_t nonce[12];
+	uint8_t tag[16];
+	struct envelope_slot tables[2][ENVELOPE_SLOTS];
+};
+
+bool envelope_detect(const uint8_t* buf, size_t len);
+void envelope_read(struct envelope* envelope, const uint8_t* buf);
+void envelope_write(const struct envelope* envelope, uint8_t* buf);
+void envelope_write_table(const struct envelope* envelope, uint8_t table, uint8_t* buf);
+size_t envelope_table_offset(uint8_t table);
+
+bool envelope_slot_used(const struct envelope_slot* slot);
+bool envelope_slot_same_kdf(
+	const struct envelope_slot* a,
+	const struct envelope_slot* b);
+bool envelope_slot_try_derive(
+	const struct envelope_slot* slot,
+	const char* pass,
+	uint8_t kek[32]);
+void envelope_slot_derive(
+	const struct envelope_slot* slot,
+	const char* pass,
+	uint8_t kek[32]);
+void envelope_slot_wrap(
+	struct envelope_slot* slot,
+	const uint8_t kek[32],
+	const uint8_t dek[32]);
+bool envelope_slot_unwrap(
+	const struct envelope_slot* slot,
+	const uint8_t kek[32],
+	uint8_t dek[32]);
+
+size_t envelope_chunked_len(size_t len);
+size_t envelope_chunked_plain_len(size_t len);
+void envelope_encrypt_chunks(
+	const struct aead* aead,
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	int jobs);
+bool envelope_decrypt_chunks(
+	const struct aead* aead,
+	const uint8_t key[32],
+	const uint8_t nonce[12],
+	const uint8_t* aad,
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	int jobs);
+
+int envelope_unlock(
+	const struct envelope* envelope,
+	const char* pass,
+	int hint,
+	uint8_t dek[32],
+	uint8_t kek[32]);
+
+#endif
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+
+#include "handy.h"
+#include "iobatch.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// requests in flight at once, and largest transfer of a single one
+#define IOBATCH_DEPTH 64
+#define IOBATCH_MAX_IO (1u << 30)
+// user data of the cancellations, which are not requests
+#define IOBATCH_CANCEL UINT64_MAX
+
+// the rings shared with the kernel, mapped without liburing
+struct iobatch_ring
+{
+	int fd;
+	unsigned entries;
+	uint8_t* sq_map;
+	size_t sq_map_len;
+	uint8_t* cq_map;
+	size_t cq_map_len;
+	struct io_uring_sqe* sqes;
+	size_t sqes_len;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+};
+
+enum iobatch_state
+{
+	IOBATCH_QUEUED = 0,
+	IOBATCH_IN_FLIGHT,
+	IOBATCH_CANCELLING,
+	IOBATCH_DONE,
+};
+
+static void ring_free(struct iobatch_ring* ring)
+{
+	if (ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqes_len);
+	}
+
+	if ((ring->cq_map != MAP_FAILED) && (ring->cq_map != ring->sq_map))
+	{
+		munmap(ring->cq_map, ring->cq_map_len);
+	}
+
+	if (ring->sq_map != MAP_FAILED)
+	{
+		munmap(ring->sq_map, ring->sq_map_len);
+	}
+
+	close(ring->fd);
+}
+
+static bool ring_setup(struct iobatch_ring* ring, unsigned entries)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof (params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+	if (ring->fd < 0)
+	{
+		return false;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_map_len = params.sq_off.array + (params.sq_entries * (sizeof (unsigned)));
+	ring->cq_map_len = params.cq_off.cqes + (params.cq_entries * (sizeof (struct io_uring_cqe)));
+	ring->sqes_len = params.sq_entries * (sizeof (struct io_uring_sqe));
+	ring->cq_map = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+
+	// both rings share a single mapping since linux 5.4
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+	{
+		ring->sq_map_len = MAX(ring->sq_map_len, ring->cq_map_len);
+		ring->cq_map_len = ring->sq_map_len;
+	}
+
+	ring->sq_map = mmap(
+		NULL,
+		ring->sq_map_len,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		ring->fd,
+		IORING_OFF_SQ_RING);
+
+	if (ring->sq_map == MAP_FAILED)
+	{
+		ring_free(ring);
+		return false;
+	}
+
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+	{
+		ring->cq_map = ring->sq_map;
+	}
+	else
+	{
+		ring->cq_map = mmap(
+			NULL,
+			ring->cq_map_len,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,
+			ring->fd,
+			IORING_OFF_CQ_RING);
+	}
+
+	ring->sqes = mmap(
+		NULL,
+		ring->sqes_len,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		ring->fd,
+		IORING_OFF_SQES);
+
+	if ((ring->cq_map == MAP_FAILED) || (ring->sqes == MAP_FAILED))
+	{
+		ring_free(ring);
+		return false;
+	}
+
+	ring->sq_head = (unsigned*) (ring->sq_map + params.sq_off.head);
+	ring->sq_tail = (unsigned*) (ring->sq_map + params.sq_off.tail);
+	ring->sq_mask = (unsigned*) (ring->sq_map + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) (ring->sq_map + params.sq_off.array);
+	ring->cq_head = (unsigned*) (ring->cq_map + params.cq_off.head);
+	ring->cq_tail = (unsigned*) (ring->cq_map + params.cq_off.tail);
+	ring->cq_mask = (unsigned*) (ring->cq_map + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (ring->cq_map + params.cq_off.cqes);
+
+	return true;
+}
+
+// the fallback, also used for operations the kernel does not support
+static void req_blocking(struct iobatch_req* req)
+{
+	while ((req->done < req->len) && (req->error == 0))
+	{
+		ssize_t size;
+
+		if (req->write == true)
+		{
+			size = pwrite(req->fd, req->buf + req->done, req->len - req->done, req->done);
+		}
+		else
+		{
+			size = pread(req->fd, req->buf + req->done, req->len - req->done, req->done);
+		}
+
+		if (size > 0)
+		{
+			req->done += size;
+		}
+		else if (size == 0)
+		{
+			break;
+		}
+		else if (errno != EINTR)
+		{
+			req->error = errno;
+		}
+	}
+}
+
+// queue the rest of a request, the tail is only published by ring_enter()
+static void ring_queue(struct iobatch_ring* ring, unsigned* tail, struct iobatch_req* req, size_t id)
+{
+	unsigned index = *tail & *(ring->sq_mask);
+	struct io_uring_sqe* sqe = &(ring->sqes[index]);
+
+	memset(sqe, 0, sizeof (struct io_uring_sqe));
+	sqe->opcode = (req->write == true) ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = req->fd;
+	sqe->off = req->done;
+	sqe->addr = (uint64_t) (uintptr_t) (req->buf + req->done);
+	sqe->len = MIN(req->len - req->done, IOBATCH_MAX_IO);
+	sqe->user_data = id;
+
+	ring->sq_array[index] = index;
+	++(*tail);
+}
+
+// queue the cancellation of a request in flight
+static void ring_queue_cancel(struct iobatch_ring* ring, unsigned* tail, size_t id)
+{
+	unsigned index = *tail & *(ring->sq_mask);
+	struct io_uring_sqe* sqe = &(ring->sqes[index]);
+
+	memset(sqe, 0, sizeof (struct io_uring_sqe));
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = id;
+	sqe->user_data = IOBATCH_CANCEL;
+
+	ring->sq_array[index] = index;
+	++(*tail);
+}
+
+// handle a completion, returns true if the request must be queued again
+static bool ring_complete(struct iobatch_req* req, int res)
+{
+	if (res > 0)
+	{
+		req->done += res;
+		return (req->done < req->len);
+	}
+
+	// kernels before 5.6 do not know IORING_OP_READ and IORING_OP_WRITE
+	if ((res == -EINVAL) || (res == -EOPNOTSUPP))
+	{
+		req_blocking(req);
+		return false;
+	}
+
+	if ((res == -EAGAIN) || (res == -EINTR))
+	{
+		return true;
+	}
+
+	if (res < 0)
+	{
+		req->error = -res;
+	}
+
+	return false;
+}
+
+// cancel the requests still in flight and reap every completion, so the
+// kernel is done with their buffers before the blocking fallback uses them:
+// unfinished requests start over, and those the kernel may still own fail
+static void ring_cancel(
+	struct iobatch_ring* ring,
+	struct iobatch_req* reqs,
+	uint8_t* states,
+	size_t count,
+	unsigned tail,
+	unsigned queued,
+	size_t in_flight)
+{
+	size_t next = 0;
+
+	while (in_flight > 0)
+	{
+		unsigned sq_head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+		// requests not submitted yet are only found by the cancellations
+		// queued after them, when the kernel gets to both
+		while ((next < count) && ((tail - sq_head) < ring->entries))
+		{
+			if (states[next] == IOBATCH_IN_FLIGHT)
+			{
+				ring_queue_cancel(ring, &tail, next);
+				states[next] = IOBATCH_CANCELLING;
+				++queued;
+			}
+
+			++next;
+		}
+
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		int err_enter = syscall(
+			__NR_io_uring_enter,
+			ring->fd,
+			queued,
+			1,
+			IORING_ENTER_GETEVENTS,
+			NULL,
+			0);
+
+		if (err_enter >= 0)
+		{
+			queued -= MIN((unsigned) err_enter, queued);
+		}
+		else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+		{
+			break;
+		}
+
+		unsigned head = *(ring->cq_head);
+		unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		while (head != cq_tail)
+		{
+			struct io_uring_cqe* cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+			size_t id = cqe->user_data;
+
+			if (cqe->user_data != IOBATCH_CANCEL)
+			{
+				--in_flight;
+
+				if ((cqe->res > 0) && ((reqs[id].done + cqe->res) == reqs[id].len))
+				{
+					reqs[id].done = reqs[id].len;
+					states[id] = IOBATCH_DONE;
+				}
+				else
+				{
+					states[id] = IOBATCH_QUEUED;
+				}
+			}
+
+			++head;
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if ((states[i] == IOBATCH_IN_FLIGHT) || (states[i] == IOBATCH_CANCELLING))
+		{
+			reqs[i].error = EIO;
+		}
+		else if (states[i] == IOBATCH_QUEUED)
+		{
+			reqs[i].done = 0;
+		}
+	}
+}
+
+static bool ring_run(struct iobatch_ring* ring, struct iobatch_req* reqs, size_t count)
+{
+	uint8_t* states = calloc(count, 1);
+
+	if (states == NULL)
+	{
+		return false;
+	}
+
+	unsigned tail = *(ring->sq_tail);
+	size_t in_flight = 0;
+	size_t next = 0;
+	size_t left = count;
+
+	while (left > 0)
+	{
+		unsigned queued = 0;
+
+		// fill the submission ring, requests to resubmit come first
+		for (size_t i = 0; (i < next) && (in_flight < ring->entries); ++i)
+		{
+			if (states[i] == IOBATCH_QUEUED)
+			{
+				ring_queue(ring, &tail, &(reqs[i]), i);
+				states[i] = IOBATCH_IN_FLIGHT;
+				++in_flight;
+				++queued;
+			}
+		}
+
+		while ((next < count) && (in_flight < ring->entries))
+		{
+			if (reqs[next].len == 0)
+			{
+				states[next] = IOBATCH_DONE;
+				--left;
+			}
+			else
+			{
+				ring_queue(ring, &tail, &(reqs[next]), next);
+				states[next] = IOBATCH_IN_FLIGHT;
+				++in_flight;
+				++queued;
+			}
+
+			++next;
+		}
+
+		if (in_flight == 0)
+		{
+			continue;
+		}
+
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		// the buffers belong to the kernel until their completion is reaped,
+		// so interrupted waits are simply resumed
+		int err_enter;
+
+		do
+		{
+			err_enter = syscall(
+				__NR_io_uring_enter,
+				ring->fd,
+				queued,
+				1,
+				IORING_ENTER_GETEVENTS,
+				NULL,
+				0);
+
+			if (err_enter >= 0)
+			{
+				queued -= MIN((unsigned) err_enter, queued);
+			}
+		}
+		while ((err_enter < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+
+		if (err_enter < 0)
+		{
+			ring_cancel(ring, reqs, states, count, tail, queued, in_flight);
+			free(states);
+			return false;
+		}
+
+		unsigned head = *(ring->cq_head);
+		unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		while (head != cq_tail)
+		{
+			struct io_uring_cqe* cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+			size_t id = cqe->user_data;
+
+			--in_flight;
+
+			if (ring_complete(&(reqs[id]), cqe->res) == true)
+			{
+				states[id] = IOBATCH_QUEUED;
+			}
+			else
+			{
+				states[id] = IOBATCH_DONE;
+				--left;
+			}
+
+			++head;
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	free(states);
+
+	return true;
+}
+
+bool iobatch_run(struct iobatch_req* reqs, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		reqs[i].done = 0;
+		reqs[i].error = 0;
+	}
+
+	struct iobatch_ring ring;
+	bool batched = (count > 1) && ring_setup(&ring, MIN(count, IOBATCH_DEPTH));
+
+	if (batched == true)
+	{
+		batched = ring_run(&ring, reqs, count);
+		ring_free(&ring);
+	}
+
+	// also finishes what a failing ring left, once the kernel is done with it
+	for (size_t i = 0; i < count; ++i)
+	{
+		if ((batched == false) && (reqs[i].error == 0))
+		{
+			req_blocking(&(reqs[i]));
+		}
+	}
+
+	bool ok = true;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		ok = ok && (reqs[i].error == 0) && (reqs[i].done == reqs[i].len);
+	}
+
+	return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef H_SSHRAM_IOBATCH
+#define H_SSHRAM_IOBATCH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// whole-file reads and writes of many files submitted together with
+// io_uring, so slow devices get every request at once instead of one file
+// after the other; without io_uring (old kernels, seccomp filters, disabled
+// by sysctl) or for a single request, they are done one by one with pread()
+// and pwrite() instead
+//
+// every request starts at the beginning of its file, short transfers are
+// resubmitted for the rest of the buffer and reads stop at end-of-file
+
+struct iobatch_req
+{
+	int fd;
+	bool write;
+	uint8_t* buf;
+	size_t len;
+	// bytes transferred, and 0 or the errno value of the failure
+	size_t done;
+	int error;
+};
+
+// returns false if a request failed or a read stopped short
+bool iobatch_run(struct iobatch_req* reqs, size_t count);
+
+#endif
@@ -0,0 +1,229 @@
+#define _XOPEN_SOURCE 700
+
+#include "dragonfail.h"
+#include "keyfs.h"
+#include "logring.h"
+
+#ifdef SSHRAM_FUSE
+
+#define FUSE_USE_VERSION 31
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct keyfs
+{
+	const struct keyfs_entry* entries;
+	size_t count;
+};
+
+static const struct keyfs_entry* keyfs_find(const char* path)
+{
+	struct keyfs* keyfs = (struct keyfs*) fuse_get_context()->private_data;
+
+	if (path[0] != '/')
+	{
+		return NULL;
+	}
+
+	for (size_t i = 0; i < keyfs->count; ++i)
+	{
+		if (strcmp(path + 1, keyfs->entries[i].name) == 0)
+		{
+			return &(keyfs->entries[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static void* keyfs_init(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+	// the kernel must not keep copies of the keys in its page cache
+	cfg->direct_io = 1;
+	cfg->kernel_cache = 0;
+	cfg->attr_timeout = 0;
+	cfg->entry_timeout = 0;
+
+	return fuse_get_context()->private_data;
+}
+
+static int keyfs_getattr(const char* path, struct stat* st, struct fuse_file_info* fi)
+{
+	memset(st, 0, sizeof (struct stat));
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+
+	if (strcmp(path, "/") == 0)
+	{
+		st->st_mode = S_IFDIR | S_IRUSR | S_IXUSR;
+		st->st_nlink = 2;
+		return 0;
+	}
+
+	const struct keyfs_entry* entry = keyfs_find(path);
+
+	if (entry == NULL)
+	{
+		return -ENOENT;
+	}
+
+	st->st_mode = S_IFREG | S_IRUSR;
+	st->st_nlink = 1;
+	st->st_size = entry->len;
+
+	return 0;
+}
+
+static int keyfs_readdir(
+	const char* path,
+	void* buf,
+	fuse_fill_dir_t filler,
+	off_t offset,
+	struct fuse_file_info* fi,
+	enum fuse_readdir_flags flags)
+{
+	struct keyfs* keyfs = (struct keyfs*) fuse_get_context()->private_data;
+
+	if (strcmp(path, "/") != 0)
+	{
+		return -ENOENT;
+	}
+
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+
+	for (size_t i = 0; i < keyfs->count; ++i)
+	{
+		filler(buf, keyfs->entries[i].name, NULL, 0, 0);
+	}
+
+	return 0;
+}
+
+static int keyfs_open(const char* path, struct fuse_file_info* fi)
+{
+	if (keyfs_find(path) == NULL)
+	{
+		return -ENOENT;
+	}
+
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		return -EACCES;
+	}
+
+	fi->direct_io = 1;
+	fi->keep_cache = 0;
+
+	// the transmission is timed from the open, like a pipe from its first read
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	fi->fh = (time.tv_sec * 1000000000ull) + time.tv_nsec;
+
+	return 0;
+}
+
+// reads are answered straight from the locked buffer
+static int keyfs_read(
+	const char* path,
+	char* buf,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info* fi)
+{
+	const struct keyfs_entry* entry = keyfs_find(path);
+
+	if (entry == NULL)
+	{
+		return -ENOENT;
+	}
+
+	if ((offset < 0) || ((size_t) offset >= entry->len))
+	{
+		return 0;
+	}
+
+	if (size > (entry->len - offset))
+	{
+		size = entry->len - offset;
+	}
+
+	memcpy(buf, entry->buf + offset, size);
+
+	// the FUSE workers share the log ring of the serving loops
+	if ((offset + size) == entry->len)
+	{
+		struct timespec time;
+
+		clock_gettime(CLOCK_MONOTONIC, &time);
+
+		logring_push_shared(
+			LOGRING_TRANSMITTED,
+			entry->len,
+			(time.tv_sec * 1000000000ull) + time.tv_nsec - fi->fh);
+	}
+
+	return size;
+}
+
+static const struct fuse_operations keyfs_ops =
+{
+	.init = keyfs_init,
+	.getattr = keyfs_getattr,
+	.readdir = keyfs_readdir,
+	.open = keyfs_open,
+	.read = keyfs_read,
+};
+
+void keyfs_serve(
+	const char* mountpoint,
+	const struct keyfs_entry* entries,
+	size_t count)
+{
+	struct keyfs keyfs =
+	{
+		.entries = entries,
+		.count = count,
+	};
+
+	// run in the foreground, the default multi-threaded loop
+	// lets concurrent readers be served in parallel
+	char* argv[] =
+	{
+		"sshram",
+		"-f",
+		"-o",
+		"ro,noexec,nosuid,nodev,fsname=sshram,subtype=sshram",
+		(char*) mountpoint,
+		NULL,
+	};
+
+	printf("Serving private keys in %s\n", mountpoint);
+
+	int err_fuse = fuse_main(5, argv, &keyfs_ops, &keyfs);
+
+	if (err_fuse != 0)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_FUSE);
+	}
+}
+
+#else
+
+void keyfs_serve(
+	const char* mountpoint,
+	const struct keyfs_entry* entries,
+	size_t count)
+{
+	dgn_throw(SSHRAM_ERR_DEC_FUSE_MISSING);
+}
+
+#endif
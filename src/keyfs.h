@@ -0,0 +1,23 @@
+#ifndef H_SSHRAM_KEYFS
+#define H_SSHRAM_KEYFS
+
+#include <stddef.h>
+#include <stdint.h>
+
+// read-only FUSE filesystem exposing private keys held in locked memory:
+// unlike the named pipe, every open() gets its own complete copy of the key,
+// and concurrent readers are served by the FUSE worker threads
+
+struct keyfs_entry
+{
+	const char* name;
+	const uint8_t* buf;
+	size_t len;
+};
+
+void keyfs_serve(
+	const char* mountpoint,
+	const struct keyfs_entry* entries,
+	size_t count);
+
+#endif
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+
+#include "dragonfail.h"
+#include "keysock.h"
+#include "logring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define KEYSOCK_BACKLOG 16
+
+// write the private key into a memfd and seal it for good
+static int keysock_memfd(const uint8_t* buf, size_t len, void** map)
+{
+	int fd = memfd_create("sshram", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	size_t done = 0;
+
+	while (done < len)
+	{
+		ssize_t size = write(fd, buf + done, len - done);
+
+		if (size <= 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		done += size;
+	}
+
+	int err_seal = fcntl(
+		fd,
+		F_ADD_SEALS,
+		F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+	if (err_seal == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	// keep the pages of the memfd locked for as long as we serve it
+	*map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (*map == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (mlock(*map, len) != 0)
+	{
+		munmap(*map, len);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int keysock_listen(const char* path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct stat file_info;
+
+	if (strlen(path) >= sizeof (addr.sun_path))
+	{
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	// only replace a stale socket, never another kind of file
+	if (lstat(path, &file_info) == 0)
+	{
+		if (S_ISSOCK(file_info.st_mode) == 0)
+		{
+			return -1;
+		}
+
+		unlink(path);
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (sock == -1)
+	{
+		return -1;
+	}
+
+	// the socket is only accessible to us
+	mode_t mask = umask(0077);
+	int err_bind = bind(sock, (struct sockaddr*) &addr, sizeof (addr));
+
+	umask(mask);
+
+	if ((err_bind == -1) || (listen(sock, KEYSOCK_BACKLOG) == -1))
+	{
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static bool keysock_send(int client, int fd, uint64_t len)
+{
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof (int))];
+	} control;
+
+	memset(&control, 0, sizeof (control));
+
+	struct iovec iov =
+	{
+		.iov_base = &len,
+		.iov_len = sizeof (uint64_t),
+	};
+
+	struct msghdr msg =
+	{
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof (control.buf),
+	};
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof (int));
+
+	return sendmsg(client, &msg, MSG_NOSIGNAL) == sizeof (uint64_t);
+}
+
+// serve clients until SIGINT interrupts accept
+void keysock_serve(const char* path, const uint8_t* buf, size_t len)
+{
+	void* map;
+	int fd = keysock_memfd(buf, len, &map);
+
+	if (fd == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_MEMFD);
+		return;
+	}
+
+	int sock = keysock_listen(path);
+
+	if (sock == -1)
+	{
+		munlock(map, len);
+		munmap(map, len);
+		close(fd);
+
+		dgn_throw(SSHRAM_ERR_DEC_SOCKET);
+		return;
+	}
+
+	printf("Serving the private key on %s\n", path);
+
+	uid_t uid = geteuid();
+	struct ucred cred;
+	socklen_t cred_len;
+
+	while (true)
+	{
+		int client = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+
+		if (client == -1)
+		{
+			if (errno != EINTR)
+			{
+				dgn_throw(SSHRAM_ERR_DEC_SOCKET);
+			}
+
+			break;
+		}
+
+		// only hand the private key to our own processes
+		cred_len = sizeof (cred);
+
+		if ((getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1)
+			|| (cred.uid != uid))
+		{
+			logring_push(LOGRING_SOCKET_REFUSED, 0, 0);
+			close(client);
+			continue;
+		}
+
+		if (keysock_send(client, fd, len) == true)
+		{
+			logring_push(LOGRING_SOCKET_SENT, cred.pid, 0);
+		}
+		else
+		{
+			logring_push(LOGRING_SOCKET_FAILED, cred.pid, 0);
+		}
+
+		close(client);
+	}
+
+	close(sock);
+	unlink(path);
+
+	// the memfd is freed once every client has released it
+	munlock(map, len);
+	munmap(map, len);
+	close(fd);
+}
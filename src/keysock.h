@@ -0,0 +1,14 @@
+#ifndef H_SSHRAM_KEYSOCK
+#define H_SSHRAM_KEYSOCK
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Unix socket handing the private key to cooperating clients (see client.h):
+// the key is copied once into a sealed, read-only memfd kept locked in memory,
+// and the same descriptor is passed to every client owned by the same user,
+// so there is no per-client copy and no one-reader-at-a-time handshake
+
+void keysock_serve(const char* path, const uint8_t* buf, size_t len);
+
+#endif
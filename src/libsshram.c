@@ -0,0 +1,1422 @@
+#define _GNU_SOURCE
+
+#include "compress.h"
+#include "dragonfail.h"
+#include "envelope.h"
+#include "handy.h"
+#include "libsshram.h"
+#include "pool.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// files without an envelope only hold the salt, nonce and tag
+#define SSHRAM_LEGACY_HEADER_LEN (16 + 12 + 16)
+
+static void lib_log(const struct sshram_options* options, const char* format, ...)
+{
+	if (options->log == NULL)
+	{
+		return;
+	}
+
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(options->log, format, args);
+	va_end(args);
+}
+
+static void lib_hex(const struct sshram_options* options, const uint8_t* buf, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		lib_log(options, "%02x ", buf[i]);
+	}
+
+	lib_log(options, "\n");
+}
+
+static double lib_elapsed(const struct timespec* start, const struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec)
+		+ ((end->tv_nsec - start->tv_nsec) / 1e9);
+}
+
+void sshram_rng(uint8_t* out, size_t len)
+{
+	int fd = open("/dev/random", O_RDONLY);
+
+	if (fd == -1)
+	{
+		dgn_throw(SSHRAM_ERR_RNG);
+		return;
+	}
+
+	ssize_t ok = read(fd, out, len);
+
+	if (ok == -1)
+	{
+		dgn_throw(SSHRAM_ERR_RNG);
+		return;
+	}
+
+	ok = close(fd);
+
+	if (ok == -1)
+	{
+		dgn_throw(SSHRAM_ERR_RNG);
+		return;
+	}
+}
+
+// default allocator
+static uint8_t* alloc_locked(void* data, size_t len)
+{
+	uint8_t* buf = calloc(len, 1);
+
+	if (buf == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return NULL;
+	}
+
+	int err_mlock = mlock(buf, len);
+
+	if (err_mlock != 0)
+	{
+		free(buf);
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void release_locked(void* data, uint8_t* buf, size_t len)
+{
+	munlock(buf, len);
+	free(buf);
+}
+
+static const struct sshram_alloc alloc_default =
+{
+	.alloc = alloc_locked,
+	.release = release_locked,
+	.data = NULL,
+};
+
+static void lib_random(const struct sshram_options* options, uint8_t* out, size_t len)
+{
+	if (options->random == NULL)
+	{
+		sshram_rng(out, len);
+		return;
+	}
+
+	options->random->fill(options->random->data, out, len);
+}
+
+uint8_t* sshram_alloc(const struct sshram_options* options, size_t len)
+{
+	const struct sshram_alloc* alloc =
+		(options->alloc != NULL) ? options->alloc : &alloc_default;
+
+	uint8_t* buf = alloc->alloc(alloc->data, len);
+
+	if ((buf == NULL) && (dgn_catch() == false))
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+	}
+
+	return buf;
+}
+
+// buffers are always wiped before being released
+void sshram_release(const struct sshram_options* options, uint8_t* buf, size_t len)
+{
+	const struct sshram_alloc* alloc =
+		(options->alloc != NULL) ? options->alloc : &alloc_default;
+
+	if (buf == NULL)
+	{
+		return;
+	}
+
+	mem_clean(buf, len);
+	alloc->release(alloc->data, buf, len);
+}
+
+// get a new password, the buffer must be locked by the caller
+void sshram_pass_new(
+	const struct sshram_pass* source,
+	const struct sshram_options* options,
+	char* pass)
+{
+	char confirm[SSHRAM_PASS_LEN] = {0};
+
+	int err_mlock = mlock(confirm, SSHRAM_PASS_LEN);
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return;
+	}
+
+	if (source->get(source->data, SSHRAM_PASS_NEW, pass, SSHRAM_PASS_LEN) == false)
+	{
+		munlock(confirm, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_FGETS);
+		return;
+	}
+
+	if (strlen(pass) < 16)
+	{
+		munlock(confirm, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_ENC_PASS_LEN);
+		return;
+	}
+
+	// confirm password
+	if (source->get(source->data, SSHRAM_PASS_CONFIRM, confirm, SSHRAM_PASS_LEN) == false)
+	{
+		mem_clean(confirm, SSHRAM_PASS_LEN);
+		munlock(confirm, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_FGETS);
+		return;
+	}
+
+	if (strcmp(pass, confirm) != 0)
+	{
+		mem_clean(confirm, SSHRAM_PASS_LEN);
+		munlock(confirm, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_ENC_PASS_MATCH);
+		return;
+	}
+
+	mem_clean(confirm, SSHRAM_PASS_LEN);
+	munlock(confirm, SSHRAM_PASS_LEN);
+}
+
+// fill a key slot with fresh parameters and wrap the data key with the password
+void sshram_slot_new(
+	struct envelope_slot* slot,
+	const char* pass,
+	const uint8_t* key,
+	const struct sshram_options* options)
+{
+	uint8_t hash[32] = {0};
+
+	int err_mlock = mlock(hash, 32);
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return;
+	}
+
+	slot->t_cost = ENVELOPE_T_COST;
+	slot->m_cost = ENVELOPE_M_COST;
+	slot->lanes = ENVELOPE_LANES;
+
+	lib_log(options, "Generating the random salt (blocking while gathering entropy)\n");
+
+	lib_random(options, slot->salt, 16);
+	lib_random(options, slot->nonce, 12);
+
+	if (dgn_catch())
+	{
+		munlock(hash, 32);
+		return;
+	}
+
+	lib_log(options, "Deriving password with Argon2...\n");
+
+	envelope_slot_derive(slot, pass, hash);
+
+	if (dgn_catch())
+	{
+		mem_clean(hash, 32);
+		munlock(hash, 32);
+		return;
+	}
+
+	if (options->verbose == true)
+	{
+		lib_hex(options, hash, 32);
+	}
+
+	envelope_slot_wrap(slot, hash, key);
+
+	mem_clean(hash, 32);
+	munlock(hash, 32);
+}
+
+// compress the plaintext into a new locked buffer,
+// returns NULL if it does not shrink so it can be stored as-is
+static uint8_t* encode_compress(
+	const uint8_t* buf,
+	size_t len,
+	size_t* compressed_len,
+	size_t* compressed_cap,
+	const struct sshram_options* options)
+{
+	lib_log(options, "Compressing private key with LZ4...\n");
+
+	size_t cap = compress_bound(len);
+
+	if (cap == 0)
+	{
+		lib_log(options, "Private key too large to be compressed, storing it as-is\n");
+		return NULL;
+	}
+
+	uint8_t* buf_compressed = sshram_alloc(options, cap);
+
+	if (buf_compressed == NULL)
+	{
+		return NULL;
+	}
+
+	size_t size = compress_payload(buf, len, buf_compressed, cap);
+
+	if (size == 0)
+	{
+		sshram_release(options, buf_compressed, cap);
+
+		lib_log(options, "Private key does not compress, storing it as-is\n");
+		return NULL;
+	}
+
+	lib_log(options, "Compressed private key from %zu to %zu bytes\n", len, size);
+
+	*compressed_len = size;
+	*compressed_cap = cap;
+
+	return buf_compressed;
+}
+
+// large enough for any payload layout
+size_t sshram_encode_bound(size_t len)
+{
+	return ENVELOPE_HEADER_LEN + envelope_chunked_len(len);
+}
+
+// returns the encoded length, or 0 on error
+size_t sshram_encode_buf(
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	size_t out_len,
+	const struct sshram_pass* source,
+	const struct sshram_options* options)
+{
+	if (len < 2)
+	{
+		dgn_throw(SSHRAM_ERR_FTELL);
+		return 0;
+	}
+
+	if (out_len < sshram_encode_bound(len))
+	{
+		dgn_throw(SSHRAM_ERR_ENC_BUF_LEN);
+		return 0;
+	}
+
+	const struct aead* aead = aead_get(options->cipher);
+
+	if (aead == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_ENC_CIPHER);
+		return 0;
+	}
+
+	int err_mlock;
+
+	// get password
+	char pass[SSHRAM_PASS_LEN] = {0};
+
+	err_mlock = mlock(pass, SSHRAM_PASS_LEN);
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return 0;
+	}
+
+	sshram_pass_new(source, options, pass);
+
+	if (dgn_catch())
+	{
+		mem_clean(pass, SSHRAM_PASS_LEN);
+		munlock(pass, SSHRAM_PASS_LEN);
+
+		return 0;
+	}
+
+	// generate data key
+	uint8_t key[32] = {0};
+
+	err_mlock = mlock(key, 32);
+
+	if (err_mlock != 0)
+	{
+		mem_clean(pass, SSHRAM_PASS_LEN);
+		munlock(pass, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return 0;
+	}
+
+	lib_log(options, "Generating the random data key (blocking while gathering entropy)\n");
+
+	lib_random(options, key, 32);
+
+	if (dgn_catch())
+	{
+		mem_clean(pass, SSHRAM_PASS_LEN);
+		munlock(pass, SSHRAM_PASS_LEN);
+		munlock(key, 32);
+
+		return 0;
+	}
+
+	// wrap it with the derived password, both key tables start identical
+	struct envelope envelope = {0};
+
+	envelope.cipher = options->cipher;
+	sshram_slot_new(&(envelope.tables[0][0]), pass, key, options);
+
+	mem_clean(pass, SSHRAM_PASS_LEN);
+	munlock(pass, SSHRAM_PASS_LEN);
+
+	if (dgn_catch())
+	{
+		mem_clean(key, 32);
+		munlock(key, 32);
+
+		return 0;
+	}
+
+	memcpy(envelope.tables[1], envelope.tables[0], sizeof (envelope.tables[0]));
+
+	// generate nonce
+	lib_log(options, "Generating the random nonce (blocking while gathering entropy)\n");
+
+	lib_random(options, envelope.nonce, 12);
+
+	if (dgn_catch())
+	{
+		mem_clean(key, 32);
+		munlock(key, 32);
+
+		return 0;
+	}
+
+	lib_log(options, "Encoding private key with %s...\n", aead->label);
+
+	// optional compression, flagged in the header
+	const uint8_t* payload = in;
+	size_t payload_len = len;
+	uint8_t* buf_compressed = NULL;
+	size_t compressed_cap = 0;
+
+	if (options->compress == true)
+	{
+		buf_compressed = encode_compress(
+			in,
+			len,
+			&payload_len,
+			&compressed_cap,
+			options);
+
+		if (dgn_catch())
+		{
+			mem_clean(key, 32);
+			munlock(key, 32);
+
+			return 0;
+		}
+
+		if (buf_compressed != NULL)
+		{
+			payload = buf_compressed;
+			envelope.flags |= ENVELOPE_FLAG_LZ4;
+		}
+	}
+
+	// large payloads are split in chunks encrypted in parallel
+	size_t written_len;
+
+	if (payload_len > ENVELOPE_CHUNK_LEN)
+	{
+		envelope.flags |= ENVELOPE_FLAG_CHUNKED;
+	}
+
+	// the header is written first because it is authenticated with the payload
+	struct timespec time_start;
+	struct timespec time_end;
+
+	envelope_write(&envelope, out);
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+	if ((envelope.flags & ENVELOPE_FLAG_CHUNKED) != 0)
+	{
+		envelope_encrypt_chunks(
+			aead,
+			key,
+			envelope.nonce,
+			out,
+			payload,
+			payload_len,
+			out + ENVELOPE_HEADER_LEN,
+			options->jobs);
+
+		written_len = ENVELOPE_HEADER_LEN + envelope_chunked_len(payload_len);
+	}
+	else
+	{
+		aead->encrypt(
+			key,
+			envelope.nonce,
+			out,
+			ENVELOPE_AAD_LEN,
+			payload,
+			payload_len,
+			out + ENVELOPE_HEADER_LEN,
+			envelope.tag);
+
+		written_len = ENVELOPE_HEADER_LEN + payload_len;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+	envelope_write(&envelope, out);
+
+	if (options->verbose == true)
+	{
+		double elapsed = lib_elapsed(&time_start, &time_end);
+
+		lib_log(
+			options,
+			"Encoded %zu bytes in %.3f ms (%.2f MiB/s)\n",
+			payload_len,
+			elapsed * 1e3,
+			(elapsed > 0) ? (payload_len / elapsed / (1 << 20)) : 0);
+	}
+
+	// unlock remaining resources
+	sshram_release(options, buf_compressed, compressed_cap);
+	mem_clean(key, 32);
+	munlock(key, 32);
+
+	return written_len;
+}
+
+// get the password and derive it, or unlock the data key with it
+static void decode_derive(
+	const struct sshram_pass* source,
+	const struct sshram_options* options,
+	struct envelope* envelope,
+	bool enveloped,
+	struct envelope_slot* legacy,
+	uint8_t* hash)
+{
+	struct sshram_cache* cache = options->cache;
+
+	// get password
+	char pass[SSHRAM_PASS_LEN] = {0};
+
+	int err_mlock = mlock(pass, SSHRAM_PASS_LEN);
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return;
+	}
+
+	if (source->get(source->data, SSHRAM_PASS_UNLOCK, pass, SSHRAM_PASS_LEN) == false)
+	{
+		mem_clean(pass, SSHRAM_PASS_LEN);
+		munlock(pass, SSHRAM_PASS_LEN);
+
+		dgn_throw(SSHRAM_ERR_FGETS);
+		return;
+	}
+
+	lib_log(options, "Deriving password with Argon2...\n");
+
+	if (enveloped == true)
+	{
+		int unlocked = envelope_unlock(
+			envelope,
+			pass,
+			options->slot,
+			hash,
+			(cache != NULL) ? cache->kek : NULL);
+
+		if ((dgn_catch() == false) && (unlocked < 0))
+		{
+			dgn_throw(SSHRAM_ERR_DEC_UNWRAP);
+		}
+		else if (dgn_catch() == false)
+		{
+			if (options->verbose == true)
+			{
+				lib_log(options, "unlocked key slot %d\n", unlocked);
+			}
+
+			if (cache != NULL)
+			{
+				cache->params = envelope->tables[envelope->active][unlocked];
+				cache->valid = true;
+			}
+		}
+	}
+	else
+	{
+		envelope_slot_derive(legacy, pass, hash);
+
+		if ((dgn_catch() == false) && (options->verbose == true))
+		{
+			lib_hex(options, hash, 32);
+		}
+
+		if ((dgn_catch() == false) && (cache != NULL))
+		{
+			cache->params = *legacy;
+			memcpy(cache->kek, hash, 32);
+			cache->valid = true;
+		}
+	}
+
+	mem_clean(pass, SSHRAM_PASS_LEN);
+	munlock(pass, SSHRAM_PASS_LEN);
+}
+
+// reuse the cached derived password if the KDF parameters match
+static bool decode_cached(
+	const struct sshram_options* options,
+	struct envelope* envelope,
+	bool enveloped,
+	struct envelope_slot* legacy,
+	uint8_t* hash)
+{
+	struct sshram_cache* cache = options->cache;
+	bool unlocked = false;
+
+	if ((cache == NULL) || (cache->valid == false))
+	{
+		return false;
+	}
+
+	if (enveloped == true)
+	{
+		for (int slot = 0; (slot < ENVELOPE_SLOTS) && (unlocked == false); ++slot)
+		{
+			struct envelope_slot* cur = &(envelope->tables[envelope->active][slot]);
+
+			unlocked = envelope_slot_used(cur)
+				&& envelope_slot_same_kdf(cur, &(cache->params))
+				&& envelope_slot_unwrap(cur, cache->kek, hash);
+		}
+	}
+	else if (envelope_slot_same_kdf(legacy, &(cache->params)) == true)
+	{
+		memcpy(hash, cache->kek, 32);
+		unlocked = true;
+	}
+
+	if (unlocked == true)
+	{
+		lib_log(options, "Reusing the derived password\n");
+	}
+
+	return unlocked;
+}
+
+// decompress the payload into a new locked buffer, always releasing the old one
+static uint8_t* decode_inflate(
+	uint8_t* buf,
+	size_t* len,
+	const struct sshram_options* options)
+{
+	lib_log(options, "Decompressing private key with LZ4...\n");
+
+	size_t compressed_len = *len;
+	size_t original_len = compress_original_len(buf, compressed_len);
+
+	if (original_len < 2)
+	{
+		sshram_release(options, buf, compressed_len + 1);
+
+		dgn_throw(SSHRAM_ERR_DEC_INFLATE);
+		return NULL;
+	}
+
+	uint8_t* buf_inflated = sshram_alloc(options, original_len + 1);
+
+	if (buf_inflated == NULL)
+	{
+		sshram_release(options, buf, compressed_len + 1);
+		return NULL;
+	}
+
+	bool ok = compress_inflate(buf, compressed_len, buf_inflated, original_len);
+
+	sshram_release(options, buf, compressed_len + 1);
+
+	if (ok == false)
+	{
+		sshram_release(options, buf_inflated, original_len + 1);
+
+		dgn_throw(SSHRAM_ERR_DEC_INFLATE);
+		return NULL;
+	}
+
+	*len = original_len;
+
+	return buf_inflated;
+}
+
+uint8_t* sshram_decode_buf(
+	const uint8_t* in,
+	size_t len,
+	size_t* out_len,
+	const struct sshram_pass* source,
+	const struct sshram_options* options)
+{
+	struct envelope envelope = {0};
+	struct envelope_slot legacy = {0};
+	const struct aead* aead = aead_get(AEAD_CHACHA20_POLY1305);
+	bool enveloped = envelope_detect(in, len);
+	size_t header_len;
+	const uint8_t* nonce;
+	const uint8_t* tag;
+
+	if (enveloped == true)
+	{
+		envelope_read(&envelope, in);
+		header_len = ENVELOPE_HEADER_LEN;
+		nonce = envelope.nonce;
+		tag = envelope.tag;
+
+		aead = aead_get(envelope.cipher);
+
+		if (((envelope.flags & ~ENVELOPE_FLAGS_KNOWN) != 0) || (aead == NULL))
+		{
+			dgn_throw(SSHRAM_ERR_DEC_FLAGS);
+			return NULL;
+		}
+	}
+	else
+	{
+		if (len < SSHRAM_LEGACY_HEADER_LEN)
+		{
+			dgn_throw(SSHRAM_ERR_FTELL);
+			return NULL;
+		}
+
+		header_len = SSHRAM_LEGACY_HEADER_LEN;
+		nonce = in + 16;
+		tag = in + 16 + 12;
+
+		memcpy(legacy.salt, in, 16);
+		legacy.t_cost = ENVELOPE_T_COST;
+		legacy.m_cost = ENVELOPE_M_COST;
+		legacy.lanes = ENVELOPE_LANES;
+	}
+
+	size_t buf_len = len - header_len;
+	size_t plain_len = buf_len;
+	bool chunked = (enveloped == true)
+		&& ((envelope.flags & ENVELOPE_FLAG_CHUNKED) != 0);
+
+	if (chunked == true)
+	{
+		plain_len = envelope_chunked_plain_len(buf_len);
+	}
+
+	if ((buf_len < 2) || (plain_len < 2))
+	{
+		dgn_throw(SSHRAM_ERR_FTELL);
+		return NULL;
+	}
+
+	if (options->verbose == true)
+	{
+		if (enveloped == true)
+		{
+			for (int slot = 0; slot < ENVELOPE_SLOTS; ++slot)
+			{
+				struct envelope_slot* cur = &(envelope.tables[envelope.active][slot]);
+
+				if (envelope_slot_used(cur) == true)
+				{
+					lib_log(options, "salt (key slot %d): ", slot);
+					lib_hex(options, cur->salt, 16);
+				}
+			}
+		}
+		else
+		{
+			lib_log(options, "salt: ");
+			lib_hex(options, legacy.salt, 16);
+		}
+
+		lib_log(options, "nonce: ");
+		lib_hex(options, nonce, 12);
+		lib_log(options, "tag: ");
+		lib_hex(options, tag, 16);
+	}
+
+	// reuse the derived password, or derive it again
+	uint8_t hash[32] = {0};
+
+	int err_mlock = mlock(hash, 32);
+
+	if (err_mlock != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return NULL;
+	}
+
+	if (decode_cached(options, &envelope, enveloped, &legacy, hash) == false)
+	{
+		decode_derive(source, options, &envelope, enveloped, &legacy, hash);
+
+		if (dgn_catch())
+		{
+			mem_clean(hash, 32);
+			munlock(hash, 32);
+
+			return NULL;
+		}
+	}
+
+	// decode the payload straight from the input buffer
+	uint8_t* buf_decoded = sshram_alloc(options, plain_len + 1);
+
+	if (buf_decoded == NULL)
+	{
+		mem_clean(hash, 32);
+		munlock(hash, 32);
+
+		return NULL;
+	}
+
+	lib_log(options, "Decoding private key with %s...\n", aead->label);
+
+	struct timespec time_start;
+	struct timespec time_end;
+	int err_decode = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+	if (chunked == true)
+	{
+		bool ok = envelope_decrypt_chunks(
+			aead,
+			hash,
+			nonce,
+			in,
+			in + header_len,
+			buf_len,
+			buf_decoded,
+			options->jobs);
+
+		err_decode = (ok == true) ? 0 : 1;
+	}
+	else
+	{
+		err_decode = aead->decrypt(
+			hash,
+			nonce,
+			(enveloped == true) ? in : NULL,
+			(enveloped == true) ? ENVELOPE_AAD_LEN : 0,
+			in + header_len,
+			buf_len,
+			tag,
+			buf_decoded);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+	mem_clean(hash, 32);
+	munlock(hash, 32);
+
+	if (err_decode != 0)
+	{
+		sshram_release(options, buf_decoded, plain_len + 1);
+
+		dgn_throw(SSHRAM_ERR_DEC_CHACHAPOLY);
+		return NULL;
+	}
+
+	if (options->verbose == true)
+	{
+		double elapsed = lib_elapsed(&time_start, &time_end);
+
+		lib_log(
+			options,
+			"Decoded %zu bytes in %.3f ms (%.2f MiB/s)\n",
+			plain_len,
+			elapsed * 1e3,
+			(elapsed > 0) ? (plain_len / elapsed / (1 << 20)) : 0);
+	}
+
+	// the flag was authenticated with the payload
+	if ((enveloped == true) && ((envelope.flags & ENVELOPE_FLAG_LZ4) != 0))
+	{
+		buf_decoded = decode_inflate(buf_decoded, &plain_len, options);
+
+		if (dgn_catch())
+		{
+			return NULL;
+		}
+	}
+
+	buf_decoded[plain_len] = '\0';
+
+	if (options->verbose == true)
+	{
+		lib_log(options, "%s\n", buf_decoded);
+	}
+
+	*out_len = plain_len;
+
+	return buf_decoded;
+}
+
+enum batch_state
+{
+	BATCH_LOCKED,
+	BATCH_BUSY,
+	BATCH_DONE,
+	BATCH_FAILED,
+};
+
+// a distinct salt and set of KDF parameters, derived once per password
+struct batch_kdf
+{
+	struct envelope_slot params;
+	uint8_t kek[32];
+	// data key unwrapped with kek, kept in the locked array like it
+	uint8_t dek[32];
+	// only derived again with the next password if it still locks files
+	bool needed;
+};
+
+struct batch_file
+{
+	struct envelope envelope;
+	bool enveloped;
+	const struct aead* aead;
+	const uint8_t* nonce;
+	const uint8_t* tag;
+	size_t header_len;
+	size_t payload_len;
+	size_t plain_len;
+	size_t kdfs[ENVELOPE_SLOTS];
+	int kdfs_count;
+	// enum batch_state, claimed atomically by the derivation tasks
+	int state;
+	// bit k is set once kdfs[k] was tried with the current password
+	uint32_t tried;
+};
+
+struct batch
+{
+	struct sshram_file* files;
+	struct batch_file* state;
+	size_t count;
+	struct batch_kdf* kdfs;
+	size_t kdfs_count;
+	size_t* todo;
+	const char* pass;
+};
+
+// find the KDF parameters of a key slot, or add them
+static void batch_kdf(struct batch* batch, struct batch_file* file, const struct envelope_slot* slot)
+{
+	size_t i = 0;
+
+	while ((i < batch->kdfs_count)
+		&& (envelope_slot_same_kdf(&(batch->kdfs[i].params), slot) == false))
+	{
+		++i;
+	}
+
+	// there is room for every key slot of every file
+	if (i == batch->kdfs_count)
+	{
+		memset(&(batch->kdfs[i]), 0, sizeof (struct batch_kdf));
+		batch->kdfs[i].params = *slot;
+		++(batch->kdfs_count);
+	}
+
+	file->kdfs[file->kdfs_count] = i;
+	++(file->kdfs_count);
+}
+
+// parse the header and allocate the decoded buffer, on the calling thread
+static const char* batch_load(
+	struct batch* batch,
+	size_t index,
+	const struct sshram_options* options)
+{
+	struct sshram_file* out = &(batch->files[index]);
+	struct batch_file* file = &(batch->state[index]);
+
+	file->enveloped = envelope_detect(out->in, out->len);
+
+	if (file->enveloped == true)
+	{
+		envelope_read(&(file->envelope), out->in);
+		file->aead = aead_get(file->envelope.cipher);
+		file->header_len = ENVELOPE_HEADER_LEN;
+		file->nonce = file->envelope.nonce;
+		file->tag = file->envelope.tag;
+
+		if (((file->envelope.flags & ~ENVELOPE_FLAGS_KNOWN) != 0) || (file->aead == NULL))
+		{
+			return "unknown format flags";
+		}
+
+		for (int slot = 0; slot < ENVELOPE_SLOTS; ++slot)
+		{
+			struct envelope_slot* cur = &(file->envelope.tables[file->envelope.active][slot]);
+
+			if ((envelope_slot_used(cur) == true)
+				&& ((options->slot < 0) || (options->slot == slot)))
+			{
+				batch_kdf(batch, file, cur);
+			}
+		}
+
+		if (file->kdfs_count == 0)
+		{
+			return "no key slot";
+		}
+	}
+	else
+	{
+		if (out->len < SSHRAM_LEGACY_HEADER_LEN)
+		{
+			return "file too short";
+		}
+
+		struct envelope_slot legacy = {0};
+
+		memcpy(legacy.salt, out->in, 16);
+		legacy.t_cost = ENVELOPE_T_COST;
+		legacy.m_cost = ENVELOPE_M_COST;
+		legacy.lanes = ENVELOPE_LANES;
+
+		file->aead = aead_get(AEAD_CHACHA20_POLY1305);
+		file->header_len = SSHRAM_LEGACY_HEADER_LEN;
+		file->nonce = out->in + 16;
+		file->tag = out->in + 16 + 12;
+
+		batch_kdf(batch, file, &legacy);
+	}
+
+	file->payload_len = out->len - file->header_len;
+	file->plain_len = file->payload_len;
+
+	if ((file->enveloped == true) && ((file->envelope.flags & ENVELOPE_FLAG_CHUNKED) != 0))
+	{
+		file->plain_len = envelope_chunked_plain_len(file->payload_len);
+	}
+
+	if ((file->payload_len < 2) || (file->plain_len < 2))
+	{
+		return "file too short";
+	}
+
+	out->out = sshram_alloc(options, file->plain_len + 1);
+
+	if (out->out == NULL)
+	{
+		dgn_reset();
+		return "couldn't allocate locked memory";
+	}
+
+	return NULL;
+}
+
+// decrypt a file with a candidate data key, in its own thread
+static void batch_open(struct batch* batch, size_t index, const uint8_t* dek)
+{
+	struct sshram_file* out = &(batch->files[index]);
+	struct batch_file* file = &(batch->state[index]);
+	struct timespec time_start;
+	struct timespec time_end;
+	bool ok;
+
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+	if ((file->enveloped == true) && ((file->envelope.flags & ENVELOPE_FLAG_CHUNKED) != 0))
+	{
+		// files are already decoded in parallel
+		ok = envelope_decrypt_chunks(
+			file->aead,
+			dek,
+			file->nonce,
+			out->in,
+			out->in + file->header_len,
+			file->payload_len,
+			out->out,
+			1);
+	}
+	else
+	{
+		ok = file->aead->decrypt(
+			dek,
+			file->nonce,
+			(file->enveloped == true) ? out->in : NULL,
+			(file->enveloped == true) ? ENVELOPE_AAD_LEN : 0,
+			out->in + file->header_len,
+			file->payload_len,
+			file->tag,
+			out->out) == 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+	out->elapsed += lib_elapsed(&time_start, &time_end);
+
+	if (ok == true)
+	{
+		__atomic_store_n(&(file->state), BATCH_DONE, __ATOMIC_RELEASE);
+	}
+	// legacy files have no key slot to tell a wrong password from corruption
+	else if (file->enveloped == false)
+	{
+		__atomic_store_n(&(file->state), BATCH_LOCKED, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		out->error = "corrupted payload";
+		__atomic_store_n(&(file->state), BATCH_FAILED, __ATOMIC_RELEASE);
+	}
+}
+
+// derive a password and immediately decode the files it unlocks
+static void batch_derive(void* data, size_t index)
+{
+	struct batch* batch = (struct batch*) data;
+	struct batch_kdf* kdf = &(batch->kdfs[batch->todo[index]]);
+	uint8_t* dek = kdf->dek;
+
+	if (envelope_slot_try_derive(&(kdf->params), batch->pass, kdf->kek) == false)
+	{
+		return;
+	}
+
+	// files held by a task trying another key slot are visited again until
+	// this derived password was tried on them too
+	bool pending = true;
+
+	while (pending == true)
+	{
+		pending = false;
+
+		for (size_t i = 0; i < batch->count; ++i)
+		{
+			struct batch_file* file = &(batch->state[i]);
+			int uses = -1;
+
+			for (int k = 0; k < file->kdfs_count; ++k)
+			{
+				if (file->kdfs[k] == batch->todo[index])
+				{
+					uses = k;
+				}
+			}
+
+			if ((uses == -1)
+				|| ((__atomic_load_n(&(file->tried), __ATOMIC_ACQUIRE) & (1u << uses)) != 0))
+			{
+				continue;
+			}
+
+			int expected = BATCH_LOCKED;
+
+			if (__atomic_compare_exchange_n(
+				&(file->state),
+				&expected,
+				BATCH_BUSY,
+				false,
+				__ATOMIC_ACQUIRE,
+				__ATOMIC_RELAXED) == false)
+			{
+				pending |= (expected == BATCH_BUSY);
+				continue;
+			}
+
+			bool unlocked = false;
+
+			if (file->enveloped == false)
+			{
+				memcpy(dek, kdf->kek, 32);
+				unlocked = true;
+			}
+
+			for (int slot = 0; (slot < ENVELOPE_SLOTS) && (unlocked == false); ++slot)
+			{
+				struct envelope_slot* cur = &(file->envelope.tables[file->envelope.active][slot]);
+
+				unlocked = envelope_slot_used(cur)
+					&& envelope_slot_same_kdf(cur, &(kdf->params))
+					&& envelope_slot_unwrap(cur, kdf->kek, dek);
+			}
+
+			__atomic_or_fetch(&(file->tried), 1u << uses, __ATOMIC_RELEASE);
+
+			if (unlocked == true)
+			{
+				batch_open(batch, i, dek);
+			}
+			else
+			{
+				__atomic_store_n(&(file->state), BATCH_LOCKED, __ATOMIC_RELEASE);
+			}
+		}
+
+		if (pending == true)
+		{
+			sched_yield();
+		}
+	}
+
+	mem_clean(dek, 32);
+}
+
+// as many derivations at once as there are cores and memory for them
+static int batch_jobs(const struct batch* batch, const struct sshram_options* options)
+{
+	uint64_t m_cost = 0;
+
+	for (size_t i = 0; i < batch->kdfs_count; ++i)
+	{
+		m_cost = MAX(m_cost, batch->kdfs[i].params.m_cost);
+	}
+
+	// argon2 memory costs are in KiB
+	return pool_jobs_fit(options->jobs, m_cost * 1024);
+}
+
+// ask a password and try it on every file still locked, returns false
+// when the source has no more passwords
+static bool batch_round(
+	struct batch* batch,
+	const struct sshram_pass* source,
+	const struct sshram_options* options,
+	size_t* decoded)
+{
+	char pass[SSHRAM_PASS_LEN] = {0};
+
+	if (mlock(pass, SSHRAM_PASS_LEN) != 0)
+	{
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return false;
+	}
+
+	if (source->get(source->data, SSHRAM_PASS_UNLOCK, pass, SSHRAM_PASS_LEN) == false)
+	{
+		mem_clean(pass, SSHRAM_PASS_LEN);
+		munlock(pass, SSHRAM_PASS_LEN);
+		return false;
+	}
+
+	// only derive the salts of the files still locked
+	size_t todo = 0;
+
+	for (size_t i = 0; i < batch->kdfs_count; ++i)
+	{
+		batch->kdfs[i].needed = false;
+	}
+
+	for (size_t i = 0; i < batch->count; ++i)
+	{
+		batch->state[i].tried = 0;
+
+		for (int k = 0; (batch->state[i].state == BATCH_LOCKED) && (k < batch->state[i].kdfs_count); ++k)
+		{
+			batch->kdfs[batch->state[i].kdfs[k]].needed = true;
+		}
+	}
+
+	for (size_t i = 0; i < batch->kdfs_count; ++i)
+	{
+		if (batch->kdfs[i].needed == true)
+		{
+			batch->todo[todo] = i;
+			++todo;
+		}
+	}
+
+	int jobs = batch_jobs(batch, options);
+	struct timespec time_start;
+	struct timespec time_end;
+	size_t before = *decoded;
+
+	lib_log(
+		options,
+		"Deriving password with Argon2 for %zu distinct salts on %d threads...\n",
+		todo,
+		(int) MIN((size_t) jobs, todo));
+
+	batch->pass = pass;
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+	pool_run(jobs, todo, batch_derive, batch);
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+	batch->pass = NULL;
+
+	mem_clean(pass, SSHRAM_PASS_LEN);
+	munlock(pass, SSHRAM_PASS_LEN);
+
+	*decoded = 0;
+
+	for (size_t i = 0; i < batch->count; ++i)
+	{
+		*decoded += (batch->state[i].state == BATCH_DONE);
+	}
+
+	lib_log(
+		options,
+		"Unlocked %zu files in %.3f ms\n",
+		*decoded - before,
+		lib_elapsed(&time_start, &time_end) * 1e3);
+
+	return *decoded > before;
+}
+
+size_t sshram_decode_files(
+	struct sshram_file* files,
+	size_t count,
+	const struct sshram_pass* source,
+	const struct sshram_options* options)
+{
+	struct batch batch =
+	{
+		.files = files,
+		.count = count,
+		.kdfs_count = 0,
+	};
+
+	size_t kdfs_cap = count * ENVELOPE_SLOTS;
+
+	batch.state = calloc(count, sizeof (struct batch_file));
+	batch.todo = calloc(kdfs_cap, sizeof (size_t));
+	batch.kdfs = calloc(kdfs_cap, sizeof (struct batch_kdf));
+
+	if ((batch.state == NULL) || (batch.todo == NULL) || (batch.kdfs == NULL))
+	{
+		free(batch.state);
+		free(batch.todo);
+		free(batch.kdfs);
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return 0;
+	}
+
+	// the derived passwords stay in locked memory
+	if (mlock(batch.kdfs, kdfs_cap * (sizeof (struct batch_kdf))) != 0)
+	{
+		free(batch.state);
+		free(batch.todo);
+		free(batch.kdfs);
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return 0;
+	}
+
+	size_t locked = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		files[i].out = NULL;
+		files[i].out_len = 0;
+		files[i].elapsed = 0;
+		files[i].error = batch_load(&batch, i, options);
+		batch.state[i].state = (files[i].error == NULL) ? BATCH_LOCKED : BATCH_FAILED;
+		locked += (files[i].error == NULL);
+	}
+
+	// ask for another password as long as the last one unlocked something
+	size_t decoded = 0;
+
+	while ((decoded < locked) && batch_round(&batch, source, options, &decoded));
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct sshram_file* file = &(files[i]);
+		struct batch_file* state = &(batch.state[i]);
+
+		if (dgn_catch())
+		{
+			state->state = BATCH_FAILED;
+		}
+
+		if (state->state == BATCH_DONE)
+		{
+			file->out_len = state->plain_len;
+		}
+		else if (file->out != NULL)
+		{
+			sshram_release(options, file->out, state->plain_len + 1);
+			file->out = NULL;
+
+			if (file->error == NULL)
+			{
+				file->error = "wrong password";
+			}
+
+			continue;
+		}
+		else
+		{
+			continue;
+		}
+
+		// the flag was authenticated with the payload
+		if ((state->enveloped == true) && ((state->envelope.flags & ENVELOPE_FLAG_LZ4) != 0))
+		{
+			file->out = decode_inflate(file->out, &(file->out_len), options);
+
+			if (file->out == NULL)
+			{
+				dgn_reset();
+				file->error = "couldn't decompress";
+				--decoded;
+				continue;
+			}
+		}
+
+		file->out[file->out_len] = '\0';
+	}
+
+	mem_clean(batch.kdfs, kdfs_cap * (sizeof (struct batch_kdf)));
+	munlock(batch.kdfs, kdfs_cap * (sizeof (struct batch_kdf)));
+	free(batch.kdfs);
+	free(batch.todo);
+	free(batch.state);
+
+	if (dgn_catch())
+	{
+		return 0;
+	}
+
+	return decoded;
+}
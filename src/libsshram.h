@@ -0,0 +1,142 @@
+#ifndef H_LIBSSHRAM
+#define H_LIBSSHRAM
+
+#include "envelope.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// in-memory encoding and decoding of sshram files, for the sshram executable
+// as well as other programs linking libsshram: no file is ever opened and
+// passwords are obtained from a pluggable source
+//
+// errors are reported with dragonfail, check them with dgn_catch()
+//
+// passwords are used exactly as given: the sshram executable reads them
+// with fgets(), so their trailing newline is part of them
+
+#define SSHRAM_PASS_LEN 257
+
+enum sshram_pass_reason
+{
+	SSHRAM_PASS_UNLOCK,
+	SSHRAM_PASS_NEW,
+	SSHRAM_PASS_CONFIRM,
+};
+
+// fill the locked buffer with a NUL-terminated password,
+// returning false to abort the operation
+struct sshram_pass
+{
+	bool (*get)(void* data, enum sshram_pass_reason reason, char* pass, size_t size);
+	void* data;
+};
+
+// allocator for the buffers holding secrets, which must be locked:
+// release is always given the length given to alloc
+struct sshram_alloc
+{
+	uint8_t* (*alloc)(void* data, size_t len);
+	void (*release)(void* data, uint8_t* buf, size_t len);
+	void* data;
+};
+
+// source of the salts, nonces and data keys: only replace it to get
+// reproducible outputs, for benchmarks and tests
+struct sshram_random
+{
+	void (*fill)(void* data, uint8_t* out, size_t len);
+	void* data;
+};
+
+// password derived while unlocking, to open files using the same salt and
+// KDF parameters without asking for the password again: must be locked
+struct sshram_cache
+{
+	struct envelope_slot params;
+	uint8_t kek[32];
+	bool valid;
+};
+
+struct sshram_options
+{
+	// malloc() and mlock() by default
+	const struct sshram_alloc* alloc;
+	// /dev/random by default
+	const struct sshram_random* random;
+	// optional
+	struct sshram_cache* cache;
+	// progress messages, NULL to stay quiet
+	FILE* log;
+	// key slot to try, -1 to try all of them
+	int slot;
+	// threads for chunked payloads, 0 for one per core
+	int jobs;
+	// payload cipher for encoding, see aead.h
+	int cipher;
+	bool compress;
+	// print secrets to the log
+	bool verbose;
+};
+
+void sshram_rng(uint8_t* out, size_t len);
+uint8_t* sshram_alloc(const struct sshram_options* options, size_t len);
+void sshram_release(const struct sshram_options* options, uint8_t* buf, size_t len);
+
+void sshram_pass_new(
+	const struct sshram_pass* source,
+	const struct sshram_options* options,
+	char* pass);
+void sshram_slot_new(
+	struct envelope_slot* slot,
+	const char* pass,
+	const uint8_t* key,
+	const struct sshram_options* options);
+
+size_t sshram_encode_bound(size_t len);
+size_t sshram_encode_buf(
+	const uint8_t* in,
+	size_t len,
+	uint8_t* out,
+	size_t out_len,
+	const struct sshram_pass* source,
+	const struct sshram_options* options);
+
+// the decoded buffer comes from the allocator and holds a terminating NUL
+// byte, release it with sshram_release(options, buf, *len + 1)
+uint8_t* sshram_decode_buf(
+	const uint8_t* in,
+	size_t len,
+	size_t* out_len,
+	const struct sshram_pass* source,
+	const struct sshram_options* options);
+
+// one encoded file of a batch: out and out_len are set by
+// sshram_decode_files for every decoded file, and error otherwise
+struct sshram_file
+{
+	const uint8_t* in;
+	size_t len;
+	uint8_t* out;
+	size_t out_len;
+	const char* error;
+	// seconds spent decrypting it
+	double elapsed;
+};
+
+// decode many files at once: passwords are derived concurrently, only once
+// for files sharing a salt, and each file is decrypted as soon as its key is
+// ready; another password is asked as long as the last one unlocked files
+// and some are still locked
+//
+// returns the number of decoded files, release each of them as with
+// sshram_decode_buf(): errors only concern the whole batch
+size_t sshram_decode_files(
+	struct sshram_file* files,
+	size_t count,
+	const struct sshram_pass* source,
+	const struct sshram_options* options);
+
+#endif
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+
+#include "dragonfail.h"
+#include "handy.h"
+#include "lockplan.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// stack buffers locked on the way (passwords, derived keys, data keys)
+#define LOCKPLAN_SLACK_PAGES 4
+
+// the events come first, to be aligned by the mapping
+struct lockplan_region
+{
+	uint8_t events[LOCKPLAN_SMALL_EVENTS * (sizeof (struct inotify_event))];
+	uint8_t slots[LOCKPLAN_SMALL_SLOTS][LOCKPLAN_SMALL_ENCODED];
+	char path[PATH_MAX];
+};
+
+struct lockplan
+{
+	struct lockplan_region* region;
+	bool used[LOCKPLAN_SMALL_SLOTS];
+	bool small;
+
+	size_t secrets;
+	size_t encoded;
+	size_t buffers;
+	bool lock_encoded;
+	size_t locked;
+	size_t peak;
+	size_t planned;
+	size_t limit;
+};
+
+static struct lockplan plan =
+{
+	.lock_encoded = true,
+	.limit = SIZE_MAX,
+};
+
+static size_t page_len(void)
+{
+	long len = sysconf(_SC_PAGESIZE);
+
+	return (len > 0) ? (size_t) len : 4096;
+}
+
+// an unaligned buffer can span one more page than its length
+static size_t pages_of(size_t len, size_t buffers)
+{
+	size_t page = page_len();
+
+	return (((len + page - 1) / page) + buffers) * page;
+}
+
+// memory the kernel already counts as locked for this process
+static size_t locked_now(void)
+{
+	FILE* file = fopen("/proc/self/status", "r");
+
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	char line[128];
+	unsigned long kib = 0;
+
+	while (fgets(line, sizeof (line), file) != NULL)
+	{
+		if (sscanf(line, "VmLck: %lu kB", &kib) == 1)
+		{
+			break;
+		}
+	}
+
+	fclose(file);
+
+	return kib * 1024;
+}
+
+static void count(size_t len, bool lock)
+{
+	if (lock == false)
+	{
+		return;
+	}
+
+	size_t locked = __atomic_add_fetch(&(plan.locked), len, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&(plan.peak), __ATOMIC_RELAXED);
+
+	while ((locked > peak)
+		&& (__atomic_compare_exchange_n(
+			&(plan.peak),
+			&peak,
+			locked,
+			true,
+			__ATOMIC_RELAXED,
+			__ATOMIC_RELAXED) == false));
+}
+
+// a free slot of the small key region, or NULL to use the heap instead
+static uint8_t* small_alloc(size_t len)
+{
+	if ((plan.region == NULL) || (len > LOCKPLAN_SMALL_ENCODED))
+	{
+		return NULL;
+	}
+
+	for (int i = 0; i < LOCKPLAN_SMALL_SLOTS; ++i)
+	{
+		if (__atomic_exchange_n(&(plan.used[i]), true, __ATOMIC_ACQUIRE) == false)
+		{
+			return plan.region->slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+// slots are wiped by their users, so they are still zeroed when taken again
+static bool small_release(uint8_t* buf)
+{
+	uint8_t* slots = plan.region->slots[0];
+
+	if ((lockplan_small_owns(buf) == false)
+		|| (buf >= (slots + sizeof (plan.region->slots))))
+	{
+		return false;
+	}
+
+	__atomic_store_n(&(plan.used[(buf - slots) / LOCKPLAN_SMALL_ENCODED]), false, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void small_map(void)
+{
+	void* region = mmap(
+		NULL,
+		sizeof (struct lockplan_region),
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		-1,
+		0);
+
+	if (region == MAP_FAILED)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	if (mlock(region, sizeof (struct lockplan_region)) != 0)
+	{
+		munmap(region, sizeof (struct lockplan_region));
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return;
+	}
+
+	count(sizeof (struct lockplan_region), true);
+	plan.region = region;
+}
+
+static uint8_t* alloc(size_t len, bool lock)
+{
+	uint8_t* buf = small_alloc(len);
+
+	if (buf != NULL)
+	{
+		return buf;
+	}
+
+	buf = calloc(len, 1);
+
+	if (buf == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return NULL;
+	}
+
+	if ((lock == true) && (mlock(buf, len) != 0))
+	{
+		free(buf);
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return NULL;
+	}
+
+	count(len, lock);
+
+	return buf;
+}
+
+static void release(uint8_t* buf, size_t len, bool lock)
+{
+	if ((plan.region != NULL) && (small_release(buf) == true))
+	{
+		return;
+	}
+
+	if (lock == true)
+	{
+		munlock(buf, len);
+		__atomic_sub_fetch(&(plan.locked), len, __ATOMIC_RELAXED);
+	}
+
+	free(buf);
+}
+
+static uint8_t* alloc_secret(void* data, size_t len)
+{
+	return alloc(len, true);
+}
+
+static void release_secret(void* data, uint8_t* buf, size_t len)
+{
+	release(buf, len, true);
+}
+
+// the plan is picked before any encoded buffer is allocated
+static uint8_t* alloc_encoded(void* data, size_t len)
+{
+	return alloc(len, plan.lock_encoded);
+}
+
+static void release_encoded(void* data, uint8_t* buf, size_t len)
+{
+	release(buf, len, plan.lock_encoded);
+}
+
+const struct sshram_alloc lockplan_secrets =
+{
+	.alloc = alloc_secret,
+	.release = release_secret,
+	.data = NULL,
+};
+
+const struct sshram_alloc lockplan_encoded =
+{
+	.alloc = alloc_encoded,
+	.release = release_encoded,
+	.data = NULL,
+};
+
+// plan the small key region instead of separate buffers if the file fits
+bool lockplan_small(size_t encoded_len)
+{
+	if ((encoded_len == 0) || (encoded_len > LOCKPLAN_SMALL_ENCODED))
+	{
+		return false;
+	}
+
+	plan.small = true;
+	lockplan_need(sizeof (struct lockplan_region), true);
+
+	return true;
+}
+
+char* lockplan_small_path(size_t len)
+{
+	if ((plan.region == NULL) || (len > sizeof (plan.region->path)))
+	{
+		return NULL;
+	}
+
+	return plan.region->path;
+}
+
+uint8_t* lockplan_small_events(size_t len)
+{
+	if ((plan.region == NULL) || (len > sizeof (plan.region->events)))
+	{
+		return NULL;
+	}
+
+	return plan.region->events;
+}
+
+bool lockplan_small_owns(const void* buf)
+{
+	const uint8_t* start = (const uint8_t*) plan.region;
+
+	return (plan.region != NULL)
+		&& ((const uint8_t*) buf >= start)
+		&& ((const uint8_t*) buf < (start + sizeof (struct lockplan_region)));
+}
+
+void lockplan_need(size_t len, bool secret)
+{
+	if (secret == true)
+	{
+		plan.secrets += len;
+	}
+	else
+	{
+		plan.encoded += len;
+	}
+
+	++(plan.buffers);
+}
+
+// lock everything if possible, only the secrets otherwise, or fail
+static bool fit(bool verbose)
+{
+	struct rlimit limit;
+	size_t base = locked_now();
+	size_t secrets = pages_of(plan.secrets, plan.buffers + LOCKPLAN_SLACK_PAGES);
+	size_t encoded = pages_of(plan.encoded, 0);
+
+	plan.lock_encoded = true;
+	plan.planned = secrets + encoded;
+
+	// privileged processes are not bound by the limit
+	if ((geteuid() == 0)
+		|| (getrlimit(RLIMIT_MEMLOCK, &limit) != 0)
+		|| (limit.rlim_cur == RLIM_INFINITY))
+	{
+		return true;
+	}
+
+	plan.limit = limit.rlim_cur;
+
+	size_t avail = (plan.limit > base) ? (plan.limit - base) : 0;
+
+	if ((secrets + encoded) <= avail)
+	{
+		return true;
+	}
+
+	if (secrets <= avail)
+	{
+		plan.lock_encoded = false;
+		plan.planned = secrets;
+
+		if (verbose == true)
+		{
+			printf(
+				"Keeping the encoded data in regular memory to fit in the locked memory limit "
+				"(%zu bytes needed for everything, %zu available)\n",
+				secrets + encoded,
+				avail);
+		}
+
+		return true;
+	}
+
+	fprintf(
+		stderr,
+		"%zu bytes of memory must be locked but only %zu are available "
+		"(RLIMIT_MEMLOCK is %zu bytes): %zu bytes are missing, raise the limit with `ulimit -l`\n",
+		secrets,
+		avail,
+		plan.limit,
+		secrets - avail);
+
+	dgn_throw(SSHRAM_ERR_MLOCK_LIMIT);
+
+	return false;
+}
+
+void lockplan_fit(bool verbose)
+{
+	if ((fit(verbose) == true) && (plan.small == true))
+	{
+		small_map();
+	}
+}
+
+// buffers from lockplan_secrets, released without their options
+void lockplan_release(uint8_t* buf, size_t len)
+{
+	mem_clean(buf, len);
+	release(buf, len, true);
+}
+
+void lockplan_report(void)
+{
+	if (plan.region != NULL)
+	{
+		printf(
+			"Small private key: buffers taken from a locked region of %zu bytes\n",
+			sizeof (struct lockplan_region));
+	}
+
+	printf(
+		"Locked memory: peak of %zu bytes in buffers (%zu planned with page rounding",
+		plan.peak,
+		plan.planned);
+
+	if (plan.limit == SIZE_MAX)
+	{
+		printf(", no limit)\n");
+	}
+	else
+	{
+		printf(", limit of %zu bytes)\n", plan.limit);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef H_SSHRAM_LOCKPLAN
+#define H_SSHRAM_LOCKPLAN
+
+#include "libsshram.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// locked memory planning for the sshram executable: the buffers a run will
+// lock are added up before asking for a password, so a RLIMIT_MEMLOCK too
+// low for them fails right away with the exact shortfall instead of after
+// the key derivation
+//
+// the encoded data is not secret: it is only locked when the limit allows
+// it, and kept in regular memory otherwise so that the secrets still fit
+//
+// the size of LZ4-compressed contents is unknown until they are decoded,
+// so their decompressed copy is not part of the plan
+
+// private keys below one page, such as ed25519 keys, never touch the heap:
+// when the encoded file is small enough, every buffer of the allocators
+// below, the named pipe path and the inotify events come from a single
+// region of fixed size, mapped and locked by lockplan_fit()
+#define LOCKPLAN_SMALL_PLAIN 4096
+#define LOCKPLAN_SMALL_ENCODED \
+	(ENVELOPE_HEADER_LEN + ENVELOPE_CHUNK_TAG_LEN + LOCKPLAN_SMALL_PLAIN)
+// encoded file, compressed and inflated copies, and the previous key on reload
+#define LOCKPLAN_SMALL_SLOTS 4
+#define LOCKPLAN_SMALL_EVENTS 64
+
+// secrets (plaintexts, compressed plaintexts, key material)
+extern const struct sshram_alloc lockplan_secrets;
+// encoded data, locked depending on the plan
+extern const struct sshram_alloc lockplan_encoded;
+
+bool lockplan_small(size_t encoded_len);
+char* lockplan_small_path(size_t len);
+uint8_t* lockplan_small_events(size_t len);
+bool lockplan_small_owns(const void* buf);
+
+void lockplan_need(size_t len, bool secret);
+void lockplan_fit(bool verbose);
+void lockplan_release(uint8_t* buf, size_t len);
+void lockplan_report(void);
+
+#endif
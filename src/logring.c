@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+
+#include "dragonfail.h"
+#include "logring.h"
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+// head and tail are kept on separate cache lines
+struct logring
+{
+	uint64_t head;
+	uint8_t pad_head[56];
+	uint64_t tail;
+	uint8_t pad_tail[56];
+	// bumped on every push, the drain thread sleeps on it with a futex
+	// and is only woken up when it announced it was waiting
+	uint32_t seq;
+	bool waiting;
+	uint64_t dropped;
+	uint64_t reported;
+	uint64_t start;
+	bool syslog;
+	bool running;
+	bool stop;
+	pthread_t thread;
+	struct logring_record records[LOGRING_LEN];
+};
+
+static struct logring ring = {0};
+// serializes the producers of logring_push_shared()
+static pthread_mutex_t ring_producers = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t logring_now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (time.tv_sec * 1000000000ull) + time.tv_nsec;
+}
+
+// records are written late, so they are stamped with the time they were
+// pushed at, in seconds since the ring was started
+static void logring_write(uint64_t time, const char* message)
+{
+	if (ring.syslog == true)
+	{
+		syslog(LOG_INFO, "%s", message);
+	}
+	else
+	{
+		printf("[%.6f] %s\n", (time - ring.start) / 1e9, message);
+		fflush(stdout);
+	}
+}
+
+static void logring_format(const struct logring_record* record, char* message, size_t size)
+{
+	double elapsed = record->ns / 1e9;
+
+	switch (record->event)
+	{
+		case LOGRING_TRANSMITTED:
+		{
+			snprintf(
+				message,
+				size,
+				"Private key transmitted (%lu bytes, %.2f MiB/s)",
+				(unsigned long) record->value,
+				(elapsed > 0) ? (record->value / elapsed / (1 << 20)) : 0);
+			break;
+		}
+		case LOGRING_ABORTED:
+		{
+			snprintf(
+				message,
+				size,
+				"Private key transmission aborted by the reader");
+			break;
+		}
+		case LOGRING_SEALED_COST:
+		{
+			snprintf(
+				message,
+				size,
+				"Sealed private key decrypted in %.3f ms",
+				elapsed * 1e3);
+			break;
+		}
+		case LOGRING_RELOADED:
+		{
+			snprintf(
+				message,
+				size,
+				"Encoded file reloaded (%.3f ms)",
+				elapsed * 1e3);
+			break;
+		}
+		case LOGRING_RELOAD_FAILED:
+		{
+			snprintf(
+				message,
+				size,
+				"Couldn't reload the encoded file, keeping the previous private key");
+			break;
+		}
+		case LOGRING_SOCKET_SENT:
+		{
+			snprintf(
+				message,
+				size,
+				"Private key handed to process %lu",
+				(unsigned long) record->value);
+			break;
+		}
+		case LOGRING_SOCKET_FAILED:
+		{
+			snprintf(
+				message,
+				size,
+				"Private key hand-off to process %lu failed",
+				(unsigned long) record->value);
+			break;
+		}
+		case LOGRING_SOCKET_REFUSED:
+		{
+			snprintf(
+				message,
+				size,
+				"Refused a client not owned by the current user");
+			break;
+		}
+		default:
+		{
+			snprintf(
+				message,
+				size,
+				"Unknown log record %u",
+				record->event);
+			break;
+		}
+	}
+}
+
+// format every queued record, returns false if there was none
+static bool logring_drain(void)
+{
+	uint64_t tail = ring.tail;
+	uint64_t head = __atomic_load_n(&(ring.head), __ATOMIC_ACQUIRE);
+	struct logring_record record;
+	char message[128];
+
+	if (tail == head)
+	{
+		return false;
+	}
+
+	while (tail != head)
+	{
+		// copy the record before giving its slot back to the producer
+		record = ring.records[tail % LOGRING_LEN];
+		++tail;
+		__atomic_store_n(&(ring.tail), tail, __ATOMIC_RELEASE);
+
+		logring_format(&record, message, sizeof (message));
+		logring_write(record.time, message);
+	}
+
+	uint64_t dropped = __atomic_load_n(&(ring.dropped), __ATOMIC_RELAXED);
+
+	if (dropped != ring.reported)
+	{
+		snprintf(
+			message,
+			sizeof (message),
+			"%lu log records dropped",
+			(unsigned long) (dropped - ring.reported));
+
+		logring_write(logring_now(), message);
+		ring.reported = dropped;
+	}
+
+	return true;
+}
+
+// lock-free on the serving thread, which only makes a system call when the
+// drain thread is asleep
+static void logring_wake(void)
+{
+	__atomic_add_fetch(&(ring.seq), 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&(ring.waiting), __ATOMIC_SEQ_CST) == true)
+	{
+		syscall(SYS_futex, &(ring.seq), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+static void* logring_thread(void* data)
+{
+	while (__atomic_load_n(&(ring.stop), __ATOMIC_ACQUIRE) == false)
+	{
+		// read before draining: a record pushed in the meantime changes it,
+		// so the wait below returns at once instead of missing the record
+		uint32_t seq = __atomic_load_n(&(ring.seq), __ATOMIC_SEQ_CST);
+
+		if (logring_drain() == true)
+		{
+			continue;
+		}
+
+		__atomic_store_n(&(ring.waiting), true, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&(ring.stop), __ATOMIC_ACQUIRE) == false)
+		{
+			syscall(SYS_futex, &(ring.seq), FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+		}
+
+		__atomic_store_n(&(ring.waiting), false, __ATOMIC_SEQ_CST);
+	}
+
+	// the producer is done, write everything left
+	logring_drain();
+
+	return NULL;
+}
+
+void logring_start(bool to_syslog)
+{
+	ring.head = 0;
+	ring.tail = 0;
+	ring.dropped = 0;
+	ring.reported = 0;
+	ring.start = logring_now();
+	ring.syslog = to_syslog;
+	ring.stop = false;
+	ring.seq = 0;
+	ring.waiting = false;
+
+	if (to_syslog == true)
+	{
+		openlog("sshram", LOG_PID, LOG_AUTHPRIV);
+	}
+
+	// the standard output is flushed before being shared with the thread
+	fflush(stdout);
+
+	// SIGINT must still interrupt the serving thread
+	sigset_t mask;
+	sigset_t mask_old;
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &mask_old);
+
+	int err_thread = pthread_create(&(ring.thread), NULL, logring_thread, NULL);
+
+	pthread_sigmask(SIG_SETMASK, &mask_old, NULL);
+
+	if (err_thread != 0)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_LOG_THREAD);
+		return;
+	}
+
+	ring.running = true;
+}
+
+// only a few stores on the serving thread
+void logring_push(enum logring_event event, uint64_t value, uint64_t ns)
+{
+	struct logring_record record =
+	{
+		.event = event,
+		.time = logring_now(),
+		.value = value,
+		.ns = ns,
+	};
+
+	// write synchronously when the thread is not running
+	if (ring.running == false)
+	{
+		char message[128];
+
+		logring_format(&record, message, sizeof (message));
+		printf("%s\n", message);
+		return;
+	}
+
+	uint64_t head = ring.head;
+
+	if ((head - __atomic_load_n(&(ring.tail), __ATOMIC_ACQUIRE)) == LOGRING_LEN)
+	{
+		__atomic_store_n(&(ring.dropped), ring.dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	ring.records[head % LOGRING_LEN] = record;
+	__atomic_store_n(&(ring.head), head + 1, __ATOMIC_RELEASE);
+	logring_wake();
+}
+
+// the producers only wait for each other for a few stores, never for output
+void logring_push_shared(enum logring_event event, uint64_t value, uint64_t ns)
+{
+	pthread_mutex_lock(&ring_producers);
+	logring_push(event, value, ns);
+	pthread_mutex_unlock(&ring_producers);
+}
+
+void logring_stop(void)
+{
+	if (ring.running == false)
+	{
+		return;
+	}
+
+	__atomic_store_n(&(ring.stop), true, __ATOMIC_RELEASE);
+	logring_wake();
+	pthread_join(ring.thread, NULL);
+
+	ring.running = false;
+
+	if (ring.syslog == true)
+	{
+		closelog();
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef H_SSHRAM_LOGRING
+#define H_SSHRAM_LOGRING
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// messages of the serving loops are queued as small binary records in a
+// single-producer ring, formatted and written by a background thread: the
+// serving thread never waits for the terminal, a pipe or the system logger,
+// and records are dropped and counted when the ring is full
+//
+// only the thread serving the private key may push records with
+// logring_push(), servers answering from several threads (like the FUSE
+// workers) use logring_push_shared() instead
+
+#define LOGRING_LEN 256
+
+enum logring_event
+{
+	LOGRING_TRANSMITTED,
+	LOGRING_ABORTED,
+	LOGRING_SEALED_COST,
+	LOGRING_RELOADED,
+	LOGRING_RELOAD_FAILED,
+	LOGRING_SOCKET_SENT,
+	LOGRING_SOCKET_FAILED,
+	LOGRING_SOCKET_REFUSED,
+};
+
+// value is a byte count, or the process id of socket clients
+struct logring_record
+{
+	uint32_t event;
+	uint64_t time;
+	uint64_t value;
+	uint64_t ns;
+};
+
+void logring_start(bool to_syslog);
+void logring_push(enum logring_event event, uint64_t value, uint64_t ns);
+void logring_push_shared(enum logring_event event, uint64_t value, uint64_t ns);
+void logring_stop(void);
+
+#endif
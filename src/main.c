@@ -1,40 +1,141 @@
 #define _XOPEN_SOURCE 700
 
+#include "aead.h"
 #include "argoat.h"
 #include "dragonfail.h"
+#include "envelope.h"
 #include "sshram.h"
 
 #include <libgen.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <termios.h>
+#include <unistd.h>
 
-#define ARG_COUNT 11
+#define ARG_COUNT 47
+#define ARG_VERIFY_MAX 256
+#define ARG_FILES_MAX 256
+#define ARG_NAMES_MAX 64
+#define ARG_MEDIA_MAX 16
 
 // arguments handling
 void arg_unflagged(void* data, char** pars, const int pars_count)
 {
 	struct config* config = (struct config*) data;
 
-	if (pars_count < 1)
+	// verification takes its own list of files
+	if (config->action == SSHRAM_ACTION_VERIFY)
+	{
+		if (pars_count > 0)
+		{
+			dgn_throw(SSHRAM_ERR_ARG_ENCODED);
+		}
+
+		return;
+	}
+
+	// the encoded file is found on removable media, optionally by its name
+	if (config->media_count > 0)
+	{
+		if ((config->action != SSHRAM_ACTION_DECODE) || (pars_count > 1)
+			|| (config->watch == true))
+		{
+			dgn_throw(SSHRAM_ERR_ARG_MEDIA_USE);
+			return;
+		}
+
+		if (pars_count == 1)
+		{
+			config->path_encoded = basename(pars[0]);
+		}
+	}
+	else if (pars_count < 1)
 	{
 		config->action = SSHRAM_ACTION_EXIT;
 		return;
 	}
 
+	// several encoded files are unlocked together and served at once
 	if (pars_count > 1)
 	{
-		dgn_throw(SSHRAM_ERR_ARG_ENCODED);
+		if (config->action != SSHRAM_ACTION_DECODE)
+		{
+			dgn_throw(SSHRAM_ERR_ARG_ENCODED);
+			return;
+		}
+
+		if ((config->socket != NULL) || (config->sealed == true) || (config->watch == true)
+			|| (config->key_name != NULL) || (config->lazy == true) || (config->queue == true))
+		{
+			dgn_throw(SSHRAM_ERR_ARG_MANY);
+			return;
+		}
+
+		config->paths = pars;
+		config->paths_count = pars_count;
 		return;
 	}
 
-	if (config->key_name == NULL)
+	if ((config->key_name == NULL) && (pars_count == 1))
 	{
 		config->key_name = basename(pars[0]);
 	}
 
+	if ((config->names_count > 1)
+		&& ((config->mountpoint != NULL) || (config->socket != NULL)
+			|| (config->sealed == true) || (config->watch == true)))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_NAMES);
+		return;
+	}
+
+	// only a named pipe can be published before unlocking
+	if ((config->lazy == true)
+		&& ((config->action != SSHRAM_ACTION_DECODE) || (config->mountpoint != NULL)
+			|| (config->socket != NULL) || (config->names_count > 1)))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_LAZY);
+		return;
+	}
+
+	// the private key sits in the pipe buffer between deliveries
+	if ((config->queue == true)
+		&& ((config->action != SSHRAM_ACTION_DECODE) || (config->mountpoint != NULL)
+			|| (config->socket != NULL) || (config->names_count > 1)
+			|| (config->sealed == true) || (config->watch == true)))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_QUEUE);
+		return;
+	}
+
+	if (config->media_count > 0)
+	{
+		return;
+	}
+
+	config->path_encoded = pars[0];
+
+	if (config->action == SSHRAM_ACTION_BENCH)
+	{
+		config->file_decoded = fopen(pars[0], "r");
+
+		if (config->file_decoded == NULL)
+		{
+			dgn_throw(SSHRAM_ERR_ARG_DECODED_OPEN);
+		}
+
+		return;
+	}
+
 	if (config->action == SSHRAM_ACTION_ENCODE)
 	{
 		config->file_encoded = fopen(pars[0], "w+");
 	}
+	else if ((config->action == SSHRAM_ACTION_REKEY)
+		|| (config->action == SSHRAM_ACTION_ADD_SLOT))
+	{
+		config->file_encoded = fopen(pars[0], "r+");
+	}
 	else
 	{
 		config->file_encoded = fopen(pars[0], "r");
@@ -47,33 +148,181 @@ void arg_unflagged(void* data, char** pars, const int pars_count)
 	}
 }
 
+void arg_add_slot(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->action = SSHRAM_ACTION_ADD_SLOT;
+}
+
+void arg_askpass(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_ASKPASS);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+
+	config->askpass = pars[0];
+}
+
+void arg_bench(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_BENCH);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+	char* end;
+	long iterations = strtol(pars[0], &end, 10);
+
+	if ((*end != '\0') || (iterations < 1) || (iterations > INT_MAX))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_BENCH);
+		return;
+	}
+
+	config->bench = iterations;
+	config->action = SSHRAM_ACTION_BENCH;
+}
+
+void arg_fuse(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_FUSE);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+
+	config->mountpoint = pars[0];
+}
+
 void arg_help(void* data, char** pars, const int pars_count)
 {
 	printf(
 		"usage:\n"
 		"    sshram [arguments] [encoded file]\n"
+		"    sshram [arguments] [encoded files...]\n"
 		"\n"
 		"arguments:\n"
+		"    -a\n"
+		"    --add-slot\n"
+		"        add a password to [encoded file], in a new key slot\n"
+		"\n"
+		"    -A [program]\n"
+		"    --askpass [program]\n"
+		"        get decoding passwords from [program] (like ssh-askpass), which gets the prompt\n"
+		"        as its argument and must print the password on its standard output\n"
+		"\n"
+		"    -b [iterations]\n"
+		"    --bench [iterations]\n"
+		"        encode and decode the plaintext [encoded file] [iterations] times, simulate\n"
+		"        transmissions through a pipe and compare the ciphers, then exit\n"
+		"        (salts and nonces are NOT random, the password is read only once)\n"
+		"\n"
+		"    -c [cipher]\n"
+		"    --cipher [cipher]\n"
+		"        encrypt [decoded file] with chacha20-poly1305 (default) or aes-256-gcm\n"
+		"        (AES-256-GCM is much faster on CPUs with AES-NI, decoding is automatic)\n"
+		"\n"
 		"    -e [decoded file]\n"
 		"    --encode [decoded file]\n"
 		"        specify a plaintext SSH private key [decoded file] to encode in [encoded file]\n"
 		"\n"
+		"    -f [mount point]\n"
+		"    --fuse [mount point]\n"
+		"        serve the private key as a read-only file in a FUSE filesystem\n"
+		"        mounted on [mount point], instead of using a named pipe\n"
+		"\n"
 		"    -h\n"
 		"    --help\n"
 		"        print this help message\n"
 		"\n"
+		"    -j [count]\n"
+		"    --jobs [count]\n"
+		"        use [count] threads to encode and decode large files (one per core by default)\n"
+		"\n"
 		"    -k\n"
 		"    --keep\n"
 		"        do not remove the pipe after execution\n"
 		"        (progams using SSH will freeze until EOF is sent!)\n"
 		"\n"
+		"    -l\n"
+		"    --lazy\n"
+		"        create the pipe at once, but only ask the password and decode [encoded file]\n"
+		"        when a program first opens the pipe (it waits until the key is ready)\n"
+		"\n"
+		"    -m [mount root]\n"
+		"    --media [mount root]\n"
+		"        wait for [encoded file] (or any *.chachapoly file if none is given) to appear\n"
+		"        on removable media mounted under [mount root], like /run/media/$USER, and\n"
+		"        load it at once so the media can be removed; give it several times to watch\n"
+		"        several mount roots\n"
+		"\n"
+		"    -p [file descriptor]\n"
+		"    --pass-fd [file descriptor]\n"
+		"        read passwords from [file descriptor] instead of the terminal\n"
+		"        (one per line, for automated runs)\n"
+		"\n"
+		"    -q\n"
+		"    --queue\n"
+		"        keep the whole private key queued in the pipe, so programs read it without\n"
+		"        waiting for sshram (only for keys fitting in the pipe buffer)\n"
+		"\n"
+		"    -r\n"
+		"    --rekey\n"
+		"        change the password of [encoded file] without decoding its contents\n"
+		"\n"
 		"    -n [pipe name]\n"
 		"    --name [pipe name]\n"
-		"        override the pipe name (the file name of [encoded file] is used by default)\n"
+		"        override the pipe name (the file name of [encoded file] is used by default),\n"
+		"        absolute paths are used instead of ~/.ssh/[pipe name]; give it several times\n"
+		"        to serve the private key from all these pipes at once\n"
+		"\n"
+		"    -s [key slot]\n"
+		"    --slot [key slot]\n"
+		"        only try the password against the given key slot (0-7)\n"
+		"        (when changing the password, this is the key slot to change)\n"
+		"\n"
+		"    -x\n"
+		"    --sealed\n"
+		"        keep the private key encrypted in memory under an ephemeral key,\n"
+		"        and only decrypt it chunk by chunk while writing it to the pipe\n"
+		"\n"
+		"    -u [socket path]\n"
+		"    --socket [socket path]\n"
+		"        hand the private key to clients of the same user over a Unix socket\n"
+		"        as a sealed read-only memfd, instead of using a named pipe\n"
+		"\n"
+		"    -V [files or directories]\n"
+		"    --verify [files or directories]\n"
+		"        check the integrity of encoded files with a single password, without\n"
+		"        serving them (directories are searched for *.chachapoly files)\n"
 		"\n"
 		"    -v\n"
 		"    --verbose\n"
 		"        print debugging information, including plaintext private key and password hash\n"
+		"\n"
+		"    -w\n"
+		"    --watch\n"
+		"        decode [encoded file] again when it is replaced, between transmissions\n"
+		"        (the derived password is kept in locked memory to skip the key derivation)\n"
+		"\n"
+		"    -y\n"
+		"    --syslog\n"
+		"        send the messages of the transmission loop to the system logger\n"
+		"        instead of the standard output\n"
+		"\n"
+		"    -z\n"
+		"    --compress\n"
+		"        compress [decoded file] with LZ4 before encoding it\n"
+		"        (useful for large text secrets, decompression is automatic)\n"
 		);
 }
 
@@ -98,6 +347,54 @@ void arg_encode(void* data, char** pars, const int pars_count)
 	config->action = SSHRAM_ACTION_ENCODE;
 }
 
+void arg_compress(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->compress = true;
+}
+
+void arg_cipher(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_CIPHER);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+	int cipher = aead_find(pars[0]);
+
+	if (cipher < 0)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_CIPHER);
+		return;
+	}
+
+	config->cipher = cipher;
+}
+
+void arg_jobs(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_JOBS);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+	char* end;
+	long jobs = strtol(pars[0], &end, 10);
+
+	if ((*end != '\0') || (jobs < 0) || (jobs > INT_MAX))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_JOBS);
+		return;
+	}
+
+	config->jobs = jobs;
+}
+
 void arg_keep(void* data, char** pars, const int pars_count)
 {
 	struct config* config = (struct config*) data;
@@ -105,17 +402,143 @@ void arg_keep(void* data, char** pars, const int pars_count)
 	config->keep_pipe = true;
 }
 
+void arg_lazy(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->lazy = true;
+}
+
+// given several times, every mount root is watched
+void arg_media(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	if ((pars_count != 1) || (config->media_count >= ARG_MEDIA_MAX))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_MEDIA);
+		return;
+	}
+
+	config->media[config->media_count] = pars[0];
+	++(config->media_count);
+}
+
+void arg_queue(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->queue = true;
+}
+
+// given several times, the private key is served from every pipe
 void arg_name(void* data, char** pars, const int pars_count)
 {
-	if (pars_count != 1)
+	struct config* config = (struct config*) data;
+
+	if ((pars_count != 1) || (config->names_count >= ARG_NAMES_MAX))
 	{
 		dgn_throw(SSHRAM_ERR_ARG_NAME);
 		return;
 	}
 
+	if (config->names_count == 0)
+	{
+		config->key_name = pars[0];
+	}
+
+	config->names[config->names_count] = pars[0];
+	++(config->names_count);
+}
+
+void arg_pass_fd(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_PASS_FD);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+	char* end;
+	long fd = strtol(pars[0], &end, 10);
+
+	if ((*end != '\0') || (fd < 0) || (fd > INT_MAX))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_PASS_FD);
+		return;
+	}
+
+	config->file_pass = fdopen(fd, "r");
+
+	if (config->file_pass == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_PASS_FD);
+		return;
+	}
+}
+
+void arg_rekey(void* data, char** pars, const int pars_count)
+{
 	struct config* config = (struct config*) data;
 
-	config->key_name = pars[0];
+	config->action = SSHRAM_ACTION_REKEY;
+}
+
+void arg_sealed(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->sealed = true;
+}
+
+void arg_slot(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_SLOT);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+	char* end;
+	long slot = strtol(pars[0], &end, 10);
+
+	if ((*end != '\0') || (slot < 0) || (slot >= ENVELOPE_SLOTS))
+	{
+		dgn_throw(SSHRAM_ERR_ARG_SLOT);
+		return;
+	}
+
+	config->slot = slot;
+}
+
+void arg_socket(void* data, char** pars, const int pars_count)
+{
+	if (pars_count != 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_SOCKET);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+
+	config->socket = pars[0];
+}
+
+void arg_verify(void* data, char** pars, const int pars_count)
+{
+	if (pars_count < 1)
+	{
+		dgn_throw(SSHRAM_ERR_ARG_VERIFY);
+		return;
+	}
+
+	struct config* config = (struct config*) data;
+
+	config->verify_paths = pars;
+	config->verify_count = pars_count;
+	config->action = SSHRAM_ACTION_VERIFY;
 }
 
 void arg_verbose(void* data, char** pars, const int pars_count)
@@ -125,19 +548,63 @@ void arg_verbose(void* data, char** pars, const int pars_count)
 	config->verbose = true;
 }
 
+void arg_watch(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->watch = true;
+}
+
+void arg_syslog(void* data, char** pars, const int pars_count)
+{
+	struct config* config = (struct config*) data;
+
+	config->syslog = true;
+}
+
 // errors initialization
 void log_init(char** log)
 {
 	log[DGN_OK] =
 		"out-of-bounds log message";
 	log[SSHRAM_ERR_ARG_NAME] =
-		"couldn't set the pipe name (please give exactly one)";
+		"couldn't set the pipe name (please give exactly one per -n, 64 at most)";
+	log[SSHRAM_ERR_ARG_SLOT] =
+		"couldn't get a key slot (please give exactly one, from 0 to 7)";
+	log[SSHRAM_ERR_ARG_FUSE] =
+		"couldn't get a mount point (please give exactly one)";
+	log[SSHRAM_ERR_ARG_SOCKET] =
+		"couldn't get a socket path (please give exactly one)";
+	log[SSHRAM_ERR_ARG_PASS_FD] =
+		"couldn't open the password file descriptor (please give exactly one)";
+	log[SSHRAM_ERR_ARG_BENCH] =
+		"couldn't get an iteration count";
+	log[SSHRAM_ERR_ARG_CIPHER] =
+		"couldn't get a cipher (please give chacha20-poly1305 or aes-256-gcm)";
+	log[SSHRAM_ERR_ARG_JOBS] =
+		"couldn't get a number of jobs (please give exactly one, 0 for one per core)";
+	log[SSHRAM_ERR_ARG_VERIFY] =
+		"couldn't get files to verify (please give at least one file or directory)";
 	log[SSHRAM_ERR_ARG_DECODED] =
 		"couldn't get a decoded file name (please give exactly one)";
 	log[SSHRAM_ERR_ARG_DECODED_OPEN] =
 		"couldn't open a decoded file";
 	log[SSHRAM_ERR_ARG_ENCODED] =
-		"couldn't get an encoded file name (please give exactly one)";
+		"couldn't get an encoded file name (please give exactly one, or several to decode)";
+	log[SSHRAM_ERR_ARG_MANY] =
+		"several encoded files can't be used with -l, -n, -q, -u, -w or -x";
+	log[SSHRAM_ERR_ARG_LAZY] =
+		"-l only works with a single named pipe (not with -f, -u or several -n)";
+	log[SSHRAM_ERR_ARG_QUEUE] =
+		"-q only works with a single named pipe (not with -f, -u, -w, -x or several -n)";
+	log[SSHRAM_ERR_ARG_ASKPASS] =
+		"couldn't get an askpass program (please give exactly one)";
+	log[SSHRAM_ERR_ARG_MEDIA] =
+		"couldn't get a mount root (please give exactly one per -m, 16 at most)";
+	log[SSHRAM_ERR_ARG_MEDIA_USE] =
+		"-m only works when decoding a single encoded file, without -w";
+	log[SSHRAM_ERR_ARG_NAMES] =
+		"several pipe names can't be used with -f, -u, -w or -x";
 	log[SSHRAM_ERR_ARG_ENCODED_OPEN] =
 		"couldn't open an encoded file";
 
@@ -148,6 +615,8 @@ void log_init(char** log)
 
 	log[SSHRAM_ERR_MALLOC] =
 		"couldn't allocate memmory";
+	log[SSHRAM_ERR_MLOCK_LIMIT] =
+		"not enough lockable memory (see RLIMIT_MEMLOCK)";
 	log[SSHRAM_ERR_MLOCK] =
 		"couldn't lock memory";
 
@@ -163,6 +632,8 @@ void log_init(char** log)
 		"couldn't read file";
 	log[SSHRAM_ERR_FWRITE] =
 		"couldn't write file";
+	log[SSHRAM_ERR_FSYNC] =
+		"couldn't flush file to the storage device";
 	log[SSHRAM_ERR_TERMIOS] =
 		"termios error";
 
@@ -170,11 +641,39 @@ void log_init(char** log)
 		"password is not long enough (please use 16 bytes or more)";
 	log[SSHRAM_ERR_ENC_PASS_MATCH] =
 		"passwords did not match";
+	log[SSHRAM_ERR_ENC_BUF_LEN] =
+		"output buffer too small for the encoded file";
+	log[SSHRAM_ERR_ENC_CIPHER] =
+		"unknown cipher";
+
+	log[SSHRAM_ERR_REKEY_LEGACY] =
+		"this file uses the legacy format, please decode and encode it again";
+	log[SSHRAM_ERR_REKEY_SLOTS_FULL] =
+		"all key slots are used";
+
+	log[SSHRAM_ERR_VERIFY_EMPTY] =
+		"no encoded file to verify";
+	log[SSHRAM_ERR_VERIFY_FAILED] =
+		"some encoded files did not pass verification";
+	log[SSHRAM_ERR_BENCH_MISMATCH] =
+		"the benchmark did not give back the original file";
+	log[SSHRAM_ERR_BENCH_THREAD] =
+		"couldn't start the benchmark reader";
 
 	log[SSHRAM_ERR_DEC_CHACHAPOLY] =
 		"couldn't decode file";
+	log[SSHRAM_ERR_DEC_UNWRAP] =
+		"couldn't unwrap the data key (wrong password?)";
+	log[SSHRAM_ERR_DEC_FLAGS] =
+		"this file uses features unknown to this version of sshram";
+	log[SSHRAM_ERR_DEC_INFLATE] =
+		"couldn't decompress the private key";
+	log[SSHRAM_ERR_DEC_SEALED] =
+		"couldn't decrypt the sealed private key (memory corruption?)";
 	log[SSHRAM_ERR_DEC_PATH_LEN] =
 		"constructed file path did not have the expected length";
+	log[SSHRAM_ERR_DEC_PIPE_NAME] =
+		"several pipes have the same path";
 	log[SSHRAM_ERR_DEC_PASUNEPIPE] =
 		"the pipe path points to a file that is not a pipe";
 	log[SSHRAM_ERR_DEC_MKFIFO] =
@@ -183,6 +682,10 @@ void log_init(char** log)
 		"couldn't open the pipe";
 	log[SSHRAM_ERR_DEC_PIPE_FWRITE] =
 		"couldn't write to the pipe";
+	log[SSHRAM_ERR_DEC_PIPE_POLL] =
+		"couldn't wait for the pipe to be drained";
+	log[SSHRAM_ERR_DEC_PIPE_IOCTL] =
+		"couldn't get the amount of unread data in the pipe";
 	log[SSHRAM_ERR_DEC_PIPE_FCLOSE] =
 		"couldn't close the pipe";
 	log[SSHRAM_ERR_DEC_PIPE_UNLINK] =
@@ -197,6 +700,22 @@ void log_init(char** log)
 		"received SIGINT during inotify read";
 	log[SSHRAM_ERR_DEC_SIGACTION] =
 		"couldn't set SIGINT handler";
+	log[SSHRAM_ERR_DEC_LOG_THREAD] =
+		"couldn't start the logging thread";
+	log[SSHRAM_ERR_DEC_FUSE] =
+		"couldn't serve the FUSE filesystem";
+	log[SSHRAM_ERR_DEC_FUSE_MISSING] =
+		"FUSE support was not compiled in (build with FUSE=1)";
+	log[SSHRAM_ERR_DEC_SOCKET] =
+		"couldn't serve the Unix socket";
+	log[SSHRAM_ERR_DEC_MEMFD] =
+		"couldn't create the sealed memory file";
+	log[SSHRAM_ERR_MEDIA_ROOT] =
+		"couldn't watch a mount root (it must be an existing directory)";
+	log[SSHRAM_ERR_MEDIA_READ] =
+		"couldn't read the encoded file from the removable media";
+	log[SSHRAM_ERR_MEDIA_HEADER] =
+		"the encoded file found on the removable media can't be decoded";
 }
 
 // sshram startup
@@ -208,39 +727,103 @@ int main(int argc, char** argv)
 		.action = SSHRAM_ACTION_DECODE,
 		.file_encoded = NULL,
 		.file_decoded = NULL,
+		.file_pass = stdin,
+		.path_encoded = NULL,
 		.key_name = NULL,
+		.names = NULL,
+		.names_count = 0,
+		.mountpoint = NULL,
+		.socket = NULL,
+		.askpass = NULL,
+		.media = NULL,
+		.media_count = 0,
+		.verify_paths = NULL,
+		.verify_count = 0,
+		.paths = NULL,
+		.paths_count = 0,
+		.bench = 0,
+		.slot = -1,
+		.jobs = 0,
+		.cipher = AEAD_CHACHA20_POLY1305,
+		.compress = false,
 		.keep_pipe = false,
+		.lazy = false,
+		.queue = false,
+		.sealed = false,
 		.verbose = false,
+		.watch = false,
+		.syslog = false,
 	};
 
 	// init error handling
 	log_init(dgn_init());
 
 	// handle args
-	char* unflagged;
+	char* unflagged[ARG_FILES_MAX];
+	char* names[ARG_NAMES_MAX];
+	char* media[ARG_MEDIA_MAX];
+
+	config.names = names;
+	config.media = media;
 
 	struct argoat_sprig sprigs[ARG_COUNT] =
 	{
 		{NULL,     1, &config, arg_unflagged},
+		{"add-slot",0, &config, arg_add_slot},
+		{"a",      0, &config, arg_add_slot},
+		{"askpass",1, &config, arg_askpass},
+		{"A",      1, &config, arg_askpass},
+		{"bench",  1, &config, arg_bench},
+		{"b",      1, &config, arg_bench},
+		{"cipher", 1, &config, arg_cipher},
+		{"c",      1, &config, arg_cipher},
+		{"compress",0,&config, arg_compress},
+		{"z",      0, &config, arg_compress},
 		{"encode", 1, &config, arg_encode},
 		{"e",      1, &config, arg_encode},
+		{"fuse",   1, &config, arg_fuse},
+		{"f",      1, &config, arg_fuse},
 		{"help",   0, NULL,    arg_help},
 		{"h",      0, NULL,    arg_help},
+		{"jobs",   1, &config, arg_jobs},
+		{"j",      1, &config, arg_jobs},
 		{"keep",   0, &config, arg_keep},
 		{"k",      0, &config, arg_keep},
+		{"lazy",   0, &config, arg_lazy},
+		{"l",      0, &config, arg_lazy},
+		{"media",  1, &config, arg_media},
+		{"m",      1, &config, arg_media},
+		{"pass-fd",1, &config, arg_pass_fd},
+		{"p",      1, &config, arg_pass_fd},
+		{"queue",  0, &config, arg_queue},
+		{"q",      0, &config, arg_queue},
+		{"rekey",  0, &config, arg_rekey},
+		{"r",      0, &config, arg_rekey},
 		{"name",   1, &config, arg_name},
 		{"n",      1, &config, arg_name},
+		{"slot",   1, &config, arg_slot},
+		{"s",      1, &config, arg_slot},
+		{"sealed", 0, &config, arg_sealed},
+		{"x",      0, &config, arg_sealed},
+		{"socket", 1, &config, arg_socket},
+		{"u",      1, &config, arg_socket},
+		{"verify", ARG_VERIFY_MAX, &config, arg_verify},
+		{"V",      ARG_VERIFY_MAX, &config, arg_verify},
 		{"verbose",0, &config, arg_verbose},
 		{"v",      0, &config, arg_verbose},
+		{"watch",  0, &config, arg_watch},
+		{"w",      0, &config, arg_watch},
+		{"syslog", 0, &config, arg_syslog},
+		{"y",      0, &config, arg_syslog},
 	};
 
 	struct argoat args =
 	{
 		sprigs,
 		ARG_COUNT,
-		&unflagged,
+		unflagged,
 		0,
-		1,
+		ARG_FILES_MAX,
 	};
 
 	argoat_graze(&args, argc, argv);
@@ -260,27 +843,66 @@ int main(int argc, char** argv)
 			fclose(config.file_encoded);
 			break;
 		}
+		case SSHRAM_ACTION_REKEY:
+		case SSHRAM_ACTION_ADD_SLOT:
+		{
+			sshram_rekey(&config);
+			fclose(config.file_encoded);
+			break;
+		}
+		case SSHRAM_ACTION_VERIFY:
+		{
+			sshram_verify(&config);
+			break;
+		}
+		case SSHRAM_ACTION_BENCH:
+		{
+			sshram_bench(&config);
+			fclose(config.file_decoded);
+			break;
+		}
 		case SSHRAM_ACTION_DECODE:
 		{
 			// avoid printing '^C' on SIGINT if possible
 			struct termios ctx_a;
 			struct termios ctx_b;
-			int err_termios = tcgetattr(fileno(stdin), &ctx_a);
+			bool tty = (isatty(fileno(stdin)) != 0);
 
-			if (err_termios != 0)
+			if (tty == true)
 			{
-				dgn_throw(SSHRAM_ERR_TERMIOS);
-				break;
+				int err_termios = tcgetattr(fileno(stdin), &ctx_a);
+
+				if (err_termios != 0)
+				{
+					dgn_throw(SSHRAM_ERR_TERMIOS);
+					break;
+				}
+
+				ctx_b = ctx_a;
+				ctx_b.c_lflag &= ~ECHO;
+				tcsetattr(fileno(stdout), TCSAFLUSH, &ctx_b);
 			}
 
-			ctx_b = ctx_a;
-			ctx_b.c_lflag &= ~ECHO;
-			tcsetattr(fileno(stdout), TCSAFLUSH, &ctx_b);
+			if (config.paths_count > 1)
+			{
+				sshram_decode_many(&config);
+			}
+			else
+			{
+				sshram_decode(&config);
 
-			sshram_decode(&config);
+				// closed once the private key is unlocked
+				if (config.file_encoded != NULL)
+				{
+					fclose(config.file_encoded);
+				}
+			}
+
+			if (tty == true)
+			{
+				tcsetattr(fileno(stdout), TCSAFLUSH, &ctx_a);
+			}
 
-			tcsetattr(fileno(stdout), TCSAFLUSH, &ctx_a);
-			fclose(config.file_encoded);
 			break;
 		}
 		case SSHRAM_ACTION_EXIT:
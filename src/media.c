@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+
+#include "aead.h"
+#include "dragonfail.h"
+#include "envelope.h"
+#include "media.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MEDIA_EVENTS 16
+#define MEDIA_WATCH (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR)
+#define MEDIA_LEGACY_HEADER_LEN (16 + 12 + 16)
+
+static bool media_match(const char* file, const char* name)
+{
+	if (name != NULL)
+	{
+		return strcmp(file, name) == 0;
+	}
+
+	size_t file_len = strlen(file);
+	size_t ext_len = strlen(MEDIA_EXTENSION);
+
+	return (file_len > ext_len)
+		&& (strcmp(file + file_len - ext_len, MEDIA_EXTENSION) == 0);
+}
+
+// depth-limited search, the first regular file matching is returned and
+// every directory searched is watched (failing is fine, mounts are polled)
+static char* media_scan(
+	int inotify_fd,
+	const char* dir_path,
+	const char* name,
+	int depth,
+	size_t* len)
+{
+	DIR* dir = opendir(dir_path);
+
+	if (dir == NULL)
+	{
+		return NULL;
+	}
+
+	inotify_add_watch(inotify_fd, dir_path, MEDIA_WATCH);
+
+	struct dirent* entry;
+	struct stat file_info;
+	char* found = NULL;
+
+	while ((found == NULL) && ((entry = readdir(dir)) != NULL))
+	{
+		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+		{
+			continue;
+		}
+
+		char* path = NULL;
+
+		if (asprintf(&path, "%s/%s", dir_path, entry->d_name) == -1)
+		{
+			break;
+		}
+
+		// unreadable entries (like the mount points of other users) are skipped
+		if (stat(path, &file_info) != 0)
+		{
+			free(path);
+			continue;
+		}
+
+		if (S_ISREG(file_info.st_mode) && media_match(entry->d_name, name))
+		{
+			found = path;
+			*len = file_info.st_size;
+			continue;
+		}
+
+		if (S_ISDIR(file_info.st_mode) && (depth > 0))
+		{
+			found = media_scan(inotify_fd, path, name, depth - 1, len);
+		}
+
+		free(path);
+	}
+
+	closedir(dir);
+
+	return found;
+}
+
+// only new directories (future mount points) and complete files are relevant
+static bool media_events(int inotify_fd)
+{
+	union
+	{
+		struct inotify_event event;
+		char buf[MEDIA_EVENTS * (sizeof (struct inotify_event) + NAME_MAX + 1)];
+	} events;
+
+	ssize_t events_len = read(inotify_fd, &events, sizeof (events));
+
+	if (events_len <= 0)
+	{
+		dgn_throw((errno == EINTR) ? SSHRAM_ERR_DEC_INOTIFY_READ_INT : SSHRAM_ERR_DEC_INOTIFY_READ);
+		return false;
+	}
+
+	char* cur = events.buf;
+	bool relevant = false;
+
+	while (cur < (events.buf + events_len))
+	{
+		struct inotify_event* event = (struct inotify_event*) cur;
+
+		if (((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0)
+			|| ((event->mask & (IN_CREATE | IN_ISDIR)) == (IN_CREATE | IN_ISDIR)))
+		{
+			relevant = true;
+		}
+
+		cur += (sizeof (struct inotify_event)) + event->len;
+	}
+
+	return relevant;
+}
+
+bool media_wait(char** roots, size_t count, const char* name, char* path, size_t* len)
+{
+	int inotify_fd = inotify_init1(IN_CLOEXEC);
+
+	if (inotify_fd == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
+		return false;
+	}
+
+	// watched before the first search, so nothing can be missed in between
+	for (size_t i = 0; i < count; ++i)
+	{
+		int err_watch = inotify_add_watch(inotify_fd, roots[i], MEDIA_WATCH);
+
+		if (err_watch == -1)
+		{
+			close(inotify_fd);
+			dgn_throw(SSHRAM_ERR_MEDIA_ROOT);
+			return false;
+		}
+	}
+
+	// the mount table signals POLLPRI when a filesystem is mounted, which
+	// usually happens after its mount point was created in the root
+	int mounts_fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+
+	struct pollfd fds[2] =
+	{
+		{.fd = inotify_fd, .events = POLLIN},
+		{.fd = mounts_fd, .events = POLLPRI},
+	};
+
+	char* found = NULL;
+	bool scan = true;
+	bool announced = false;
+
+	while (true)
+	{
+		for (size_t i = 0; (scan == true) && (found == NULL) && (i < count); ++i)
+		{
+			found = media_scan(inotify_fd, roots[i], name, MEDIA_DEPTH, len);
+		}
+
+		if (found != NULL)
+		{
+			break;
+		}
+
+		if (announced == false)
+		{
+			announced = true;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				printf("Waiting for an encoded file under %s\n", roots[i]);
+			}
+
+			fflush(stdout);
+		}
+
+		if (poll(fds, 2, -1) == -1)
+		{
+			dgn_throw((errno == EINTR) ? SSHRAM_ERR_DEC_INOTIFY_READ_INT : SSHRAM_ERR_DEC_PIPE_POLL);
+			break;
+		}
+
+		scan = ((fds[1].revents & (POLLPRI | POLLERR)) != 0);
+
+		if ((fds[0].revents & POLLIN) != 0)
+		{
+			scan |= media_events(inotify_fd);
+
+			if (dgn_catch())
+			{
+				break;
+			}
+		}
+	}
+
+	if (mounts_fd != -1)
+	{
+		close(mounts_fd);
+	}
+
+	close(inotify_fd);
+
+	if (found == NULL)
+	{
+		return false;
+	}
+
+	bool fits = (strlen(found) < PATH_MAX);
+
+	if (fits == true)
+	{
+		strcpy(path, found);
+	}
+	else
+	{
+		dgn_throw(SSHRAM_ERR_MEDIA_READ);
+	}
+
+	free(found);
+
+	return fits;
+}
+
+// reject files which can't be decoded before asking for a password
+static bool media_header(const char* path, const uint8_t* buf, size_t len)
+{
+	if (envelope_detect(buf, len) == false)
+	{
+		if (len <= MEDIA_LEGACY_HEADER_LEN)
+		{
+			return false;
+		}
+
+		printf("Loaded %s (%zu bytes, legacy format)\n", path, len);
+		return true;
+	}
+
+	struct envelope envelope;
+
+	envelope_read(&envelope, buf);
+
+	const struct aead* aead = aead_get(envelope.cipher);
+
+	if (((envelope.flags & ~ENVELOPE_FLAGS_KNOWN) != 0) || (aead == NULL))
+	{
+		return false;
+	}
+
+	int slots = 0;
+
+	for (int slot = 0; slot < ENVELOPE_SLOTS; ++slot)
+	{
+		if (envelope_slot_used(&(envelope.tables[envelope.active][slot])) == true)
+		{
+			++slots;
+		}
+	}
+
+	if (slots == 0)
+	{
+		return false;
+	}
+
+	printf(
+		"Loaded %s (%zu bytes, %s, %d of %d key slots used)\n",
+		path,
+		len,
+		aead->label,
+		slots,
+		ENVELOPE_SLOTS);
+	return true;
+}
+
+uint8_t* media_load(
+	const char* path,
+	const struct sshram_options* options,
+	size_t* len)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat file_info;
+
+	if ((fd == -1) || (fstat(fd, &file_info) != 0) || (file_info.st_size < 2))
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+
+		dgn_throw(SSHRAM_ERR_MEDIA_READ);
+		return NULL;
+	}
+
+	size_t file_len = file_info.st_size;
+
+	// queue the whole file on the device at once instead of page by page
+	posix_fadvise(fd, 0, file_len, POSIX_FADV_SEQUENTIAL);
+	readahead(fd, 0, file_len);
+
+	uint8_t* buf = sshram_alloc(options, file_len);
+
+	if (buf == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	size_t done = 0;
+
+	while (done < file_len)
+	{
+		ssize_t size = read(fd, buf + done, file_len - done);
+
+		if ((size == -1) && (errno == EINTR))
+		{
+			continue;
+		}
+
+		if (size <= 0)
+		{
+			break;
+		}
+
+		done += size;
+	}
+
+	// the media is about to be removed, its cached pages are useless
+	posix_fadvise(fd, 0, file_len, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	if (done != file_len)
+	{
+		sshram_release(options, buf, file_len);
+		dgn_throw(SSHRAM_ERR_MEDIA_READ);
+		return NULL;
+	}
+
+	if (media_header(path, buf, file_len) == false)
+	{
+		sshram_release(options, buf, file_len);
+		dgn_throw(SSHRAM_ERR_MEDIA_HEADER);
+		return NULL;
+	}
+
+	*len = file_len;
+
+	return buf;
+}
@@ -0,0 +1,33 @@
+#ifndef H_SSHRAM_MEDIA
+#define H_SSHRAM_MEDIA
+
+#include "libsshram.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// encoded files kept on removable media: the mount roots (like
+// /run/media/$USER) are watched until a matching encoded file appears, which
+// is then read at once into locked memory so the media can be removed before
+// the password is even asked
+//
+// encoded files are searched in the mount roots and two levels below them,
+// and the search is repeated whenever the mount table changes or a directory
+// or file is added to one of the directories searched
+
+#define MEDIA_EXTENSION ".chachapoly"
+#define MEDIA_DEPTH 2
+
+// copies the path of the first encoded file found in path (PATH_MAX bytes)
+// and gives its size; name restricts the search to encoded files with this name
+bool media_wait(char** roots, size_t count, const char* name, char* path, size_t* len);
+
+// reads the whole encoded file in a buffer of the allocator and checks its
+// header, returns NULL and throws if the file is unusable
+uint8_t* media_load(
+	const char* path,
+	const struct sshram_options* options,
+	size_t* len);
+
+#endif
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#include "handy.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define POOL_THREADS_MAX 64
+
+struct pool
+{
+	void (*task)(void* data, size_t index);
+	void* data;
+	pthread_mutex_t mutex;
+	size_t next;
+	size_t count;
+};
+
+static void* pool_thread(void* data)
+{
+	struct pool* pool = (struct pool*) data;
+	size_t index;
+
+	while (true)
+	{
+		pthread_mutex_lock(&(pool->mutex));
+		index = pool->next;
+
+		if (index < pool->count)
+		{
+			++(pool->next);
+		}
+
+		pthread_mutex_unlock(&(pool->mutex));
+
+		if (index >= pool->count)
+		{
+			break;
+		}
+
+		pool->task(pool->data, index);
+	}
+
+	return NULL;
+}
+
+// 0 means one job per online core
+int pool_jobs(int jobs)
+{
+	if (jobs <= 0)
+	{
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	return MIN(MAX(jobs, 1), POOL_THREADS_MAX);
+}
+
+int pool_jobs_fit(int jobs, uint64_t job_len)
+{
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_len = sysconf(_SC_PAGESIZE);
+
+	jobs = pool_jobs(jobs);
+
+	if ((pages > 0) && (page_len > 0) && (job_len > 0))
+	{
+		uint64_t fit = ((uint64_t) pages * (uint64_t) page_len) / job_len;
+
+		jobs = MAX(1, MIN((uint64_t) jobs, fit));
+	}
+
+	return jobs;
+}
+
+void pool_run(
+	int jobs,
+	size_t count,
+	void (*task)(void* data, size_t index),
+	void* data)
+{
+	struct pool pool =
+	{
+		.task = task,
+		.data = data,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.next = 0,
+		.count = count,
+	};
+
+	pthread_t ids[POOL_THREADS_MAX];
+	int threads = MIN((size_t) pool_jobs(jobs), count);
+	int spawned = 0;
+
+	// the calling thread picks up the slack if some threads could not be created
+	for (int i = 1; i < threads; ++i)
+	{
+		if (pthread_create(&(ids[spawned]), NULL, pool_thread, &pool) == 0)
+		{
+			++spawned;
+		}
+	}
+
+	pool_thread(&pool);
+
+	for (int i = 0; i < spawned; ++i)
+	{
+		pthread_join(ids[i], NULL);
+	}
+
+	pthread_mutex_destroy(&(pool.mutex));
+}
@@ -0,0 +1,20 @@
+#ifndef H_SSHRAM_POOL
+#define H_SSHRAM_POOL
+
+#include <stddef.h>
+#include <stdint.h>
+
+// runs a task for every index from 0 to count, spread over a few threads,
+// the calling thread being one of them: tasks must not throw errors
+
+int pool_jobs(int jobs);
+// pool_jobs(), reduced to what fits in available memory when every job
+// needs job_len bytes (like an Argon2 derivation)
+int pool_jobs_fit(int jobs, uint64_t job_len);
+void pool_run(
+	int jobs,
+	size_t count,
+	void (*task)(void* data, size_t index),
+	void* data);
+
+#endif
@@ -0,0 +1,174 @@
+#define _XOPEN_SOURCE 700
+
+#include "chacha20poly1305.h"
+#include "dragonfail.h"
+#include "handy.h"
+#include "sealed.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// the ephemeral key is never reused, so the chunk index is a fine nonce
+static void chunk_nonce(size_t id, uint8_t nonce[12])
+{
+	memset(nonce, 0, 12);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		nonce[i] = (((uint64_t) id) >> (8 * i)) & 0xff;
+	}
+}
+
+static size_t chunk_len(const struct sealed* sealed, size_t id)
+{
+	return MIN(SEALED_CHUNK_LEN, sealed->len - (id * SEALED_CHUNK_LEN));
+}
+
+static uint8_t* chunk_cipher(const struct sealed* sealed, size_t id)
+{
+	return sealed->buf + (id * (SEALED_CHUNK_LEN + SEALED_TAG_LEN));
+}
+
+// the key must be set and the structure locked by the caller,
+// the plaintext buffer is left untouched
+void sealed_seal(struct sealed* sealed, const uint8_t* buf, size_t len)
+{
+	size_t chunks = (len + SEALED_CHUNK_LEN - 1) / SEALED_CHUNK_LEN;
+	uint8_t nonce[12];
+
+	sealed->len = len;
+	sealed->chunk_valid = false;
+	sealed->cost = 0;
+
+	// the ciphertext does not need to be locked
+	sealed->buf = malloc(len + (chunks * SEALED_TAG_LEN));
+
+	if (sealed->buf == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	sealed->chunk = malloc(SEALED_CHUNK_LEN);
+
+	if (sealed->chunk == NULL)
+	{
+		free(sealed->buf);
+		sealed->buf = NULL;
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	int err_mlock = mlock(sealed->chunk, SEALED_CHUNK_LEN);
+
+	if (err_mlock != 0)
+	{
+		free(sealed->buf);
+		free(sealed->chunk);
+		sealed->buf = NULL;
+		sealed->chunk = NULL;
+
+		dgn_throw(SSHRAM_ERR_MLOCK);
+		return;
+	}
+
+	for (size_t id = 0; id < chunks; ++id)
+	{
+		size_t size = chunk_len(sealed, id);
+		uint8_t* cipher = chunk_cipher(sealed, id);
+
+		chunk_nonce(id, nonce);
+
+		cf_chacha20poly1305_encrypt(
+			sealed->key,
+			nonce,
+			NULL,
+			0,
+			buf + (id * SEALED_CHUNK_LEN),
+			size,
+			cipher,
+			cipher + size);
+	}
+}
+
+// get the plaintext at offset, up to the end of its chunk
+// the chunk is only decrypted again after having been wiped
+const uint8_t* sealed_open(struct sealed* sealed, size_t offset, size_t* avail)
+{
+	size_t id = offset / SEALED_CHUNK_LEN;
+	size_t size = chunk_len(sealed, id);
+	size_t start = offset - (id * SEALED_CHUNK_LEN);
+
+	if ((sealed->chunk_valid == false) || (sealed->chunk_id != id))
+	{
+		struct timespec time_start;
+		struct timespec time_end;
+		uint8_t nonce[12];
+		uint8_t* cipher = chunk_cipher(sealed, id);
+
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+		chunk_nonce(id, nonce);
+
+		int err_decode = cf_chacha20poly1305_decrypt(
+			sealed->key,
+			nonce,
+			NULL,
+			0,
+			cipher,
+			size,
+			cipher + size,
+			sealed->chunk);
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+		sealed->cost +=
+			(time_end.tv_sec - time_start.tv_sec)
+			+ ((time_end.tv_nsec - time_start.tv_nsec) / 1e9);
+
+		if (err_decode != 0)
+		{
+			sealed_wipe(sealed);
+
+			dgn_throw(SSHRAM_ERR_DEC_SEALED);
+			return NULL;
+		}
+
+		sealed->chunk_id = id;
+		sealed->chunk_valid = true;
+	}
+
+	*avail = size - start;
+
+	return sealed->chunk + start;
+}
+
+void sealed_wipe(struct sealed* sealed)
+{
+	if (sealed->chunk != NULL)
+	{
+		mem_clean(sealed->chunk, SEALED_CHUNK_LEN);
+	}
+
+	sealed->chunk_valid = false;
+}
+
+void sealed_free(struct sealed* sealed)
+{
+	sealed_wipe(sealed);
+
+	if (sealed->chunk != NULL)
+	{
+		munlock(sealed->chunk, SEALED_CHUNK_LEN);
+		free(sealed->chunk);
+	}
+
+	free(sealed->buf);
+	mem_clean(sealed->key, 32);
+
+	sealed->buf = NULL;
+	sealed->chunk = NULL;
+	sealed->len = 0;
+}
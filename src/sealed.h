@@ -0,0 +1,31 @@
+#ifndef H_SSHRAM_SEALED
+#define H_SSHRAM_SEALED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the private key can be kept encrypted in memory under an ephemeral key,
+// in chunks decrypted one at a time while being written to the pipe:
+// only a single chunk of plaintext is resident, and only during transmissions
+
+#define SEALED_CHUNK_LEN (1 << 16)
+#define SEALED_TAG_LEN 16
+
+struct sealed
+{
+	uint8_t key[32];
+	uint8_t* buf;
+	size_t len;
+	uint8_t* chunk;
+	size_t chunk_id;
+	bool chunk_valid;
+	double cost;
+};
+
+void sealed_seal(struct sealed* sealed, const uint8_t* buf, size_t len);
+const uint8_t* sealed_open(struct sealed* sealed, size_t offset, size_t* avail);
+void sealed_wipe(struct sealed* sealed);
+void sealed_free(struct sealed* sealed);
+
+#endif
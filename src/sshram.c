@@ -1,26 +1,54 @@
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 700
 
-#include "argon2.h"
-#include "chacha20poly1305.h"
-#include "chrono.h"
+#include "aead.h"
+#include "compress.h"
 #include "dragonfail.h"
+#include "envelope.h"
 #include "handy.h"
+#include "iobatch.h"
+#include "keyfs.h"
+#include "keysock.h"
+#include "libsshram.h"
+#include "lockplan.h"
+#include "logring.h"
+#include "media.h"
+#include "sealed.h"
 #include "sshram.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+// upper bound on the number of coalesced inotify events read at once
+#define SSHRAM_INOTIFY_EVENTS 64
+
+enum delivery
+{
+	SSHRAM_DELIVERY_OK,
+	SSHRAM_DELIVERY_ABORTED,
+	SSHRAM_DELIVERY_ERROR,
+};
+
+
 static volatile sig_atomic_t decode_run = 1;
 
 static void sigint_handler(int sig)
@@ -28,32 +56,6 @@ static void sigint_handler(int sig)
 	decode_run = 0;
 }
 
-void sshram_rng(uint8_t* out, size_t len)
-{
-	int fd = open("/dev/random", O_RDONLY);
-
-	if (fd == -1)
-	{
-		dgn_throw(SSHRAM_ERR_RNG);
-		return;
-	}
-
-	ssize_t ok = read(fd, out, len);
-
-	if (ok == -1)
-	{
-		dgn_throw(SSHRAM_ERR_RNG);
-		return;
-	}
-
-	ok = close(fd);
-
-	if (ok == -1)
-	{
-		dgn_throw(SSHRAM_ERR_RNG);
-		return;
-	}
-}
 
 char* getpassword(char* s, int size, FILE* stream)
 {
@@ -62,6 +64,12 @@ char* getpassword(char* s, int size, FILE* stream)
 	char* err_pass;
 	int ok;
 
+	// passwords given by other programs are read as-is
+	if (isatty(fileno(stream)) == 0)
+	{
+		return fgets(s, size, stream);
+	}
+
 	ok = tcgetattr(fileno(stream), &ctx_a);
 
 	if (ok != 0)
@@ -98,429 +106,621 @@ char* getpassword(char* s, int size, FILE* stream)
 	return err_pass;
 }
 
-void sshram_encode(struct config* config)
+// get the largest pipe buffer size an unprivileged process can request
+static size_t pipe_max_size(void)
 {
-	// init timers
-	uint64_t times[16];
+	FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
 
-	chrono_init(times);
-
-	for (int i = 0; i < 16; ++i)
+	if (file == NULL)
 	{
-		chrono_start(i);
+		return 0;
 	}
 
-	int err_mlock;
-	char* err_pass;
-
-	// get password
-	char pass[257] = {0};
+	unsigned long size;
+	int ok = fscanf(file, "%lu", &size);
 
-	err_mlock = mlock(pass, 257);
+	fclose(file);
 
-	if (err_mlock != 0)
+	if (ok != 1)
 	{
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
+		return 0;
 	}
 
-	printf("Please enter a password (16-256 bytes, not that of your SSH private key!): ");
+	return size;
+}
 
-	err_pass = getpassword(pass, 257, stdin);
+// try to make the whole private key fit in the pipe buffer
+static void pipe_grow(int pipe, size_t len, size_t max)
+{
+	int size = fcntl(pipe, F_GETPIPE_SZ);
 
-	if (err_pass != pass)
+	if ((size == -1) || ((size_t) size >= len) || ((size_t) size >= max))
 	{
-		mem_clean(pass, 257);
-		munlock(pass, 257);
-
-		dgn_throw(SSHRAM_ERR_FGETS);
 		return;
 	}
 
-	if (strlen(pass) < 16)
-	{
-		mem_clean(pass, 257);
-		munlock(pass, 257);
+	// failing is fine here, we will simply stream the private key
+	fcntl(pipe, F_SETPIPE_SZ, MIN(len, max));
+}
+
+// keep at most len bytes in the pipe buffer
+static void pipe_shrink(int pipe, size_t len)
+{
+	int size = fcntl(pipe, F_GETPIPE_SZ);
 
-		dgn_throw(SSHRAM_ERR_ENC_PASS_LEN);
+	if ((size == -1) || ((size_t) size <= len))
+	{
 		return;
 	}
 
-	// confirm password
-	char confirm[257] = {0};
+	// failing only means more chunks can sit in the pipe at once
+	fcntl(pipe, F_SETPIPE_SZ, len);
+}
 
-	err_mlock = mlock(confirm, 257);
+// wait for inotify events and return the combined mask of the first one
+// matching from and of those following it, or of all of them if from is 0
+static uint32_t pipe_events_from(
+	int inotify_fd,
+	struct inotify_event* events,
+	size_t events_size,
+	uint32_t from)
+{
+	ssize_t len = read(inotify_fd, events, events_size);
 
-	if (err_mlock != 0)
+	if (len == -1)
 	{
-		mem_clean(pass, 257);
-		munlock(pass, 257);
+		if (errno == EINTR)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ_INT);
+		}
+		else
+		{
+			dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ);
+		}
 
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
+		return 0;
 	}
 
-	printf("Please confirm this password by typing it one more time: ");
+	uint32_t mask = 0;
+	bool found = (from == 0);
+	char* cur = (char*) events;
 
-	err_pass = getpassword(confirm, 257, stdin);
-
-	if (err_pass != confirm)
+	while (cur < ((char*) events + len))
 	{
-		mem_clean(pass, 257);
-		mem_clean(confirm, 257);
-		munlock(pass, 257);
-		munlock(confirm, 257);
+		struct inotify_event* event = (struct inotify_event*) cur;
 
-		dgn_throw(SSHRAM_ERR_FGETS);
-		return;
-	}
+		found = found || ((event->mask & from) != 0);
 
-	if (strcmp(pass, confirm) != 0)
-	{
-		mem_clean(pass, 257);
-		mem_clean(confirm, 257);
-		munlock(pass, 257);
-		munlock(confirm, 257);
+		if (found == true)
+		{
+			mask |= event->mask;
+		}
 
-		dgn_throw(SSHRAM_ERR_ENC_PASS_MATCH);
-		return;
+		cur += (sizeof (struct inotify_event)) + event->len;
 	}
 
-	// generate salt
-	uint8_t salt[16];
+	return mask;
+}
+
+// wait for inotify events and return their combined mask
+static uint32_t pipe_events(
+	int inotify_fd,
+	struct inotify_event* events,
+	size_t events_size)
+{
+	return pipe_events_from(inotify_fd, events, events_size, 0);
+}
 
-	printf("Generating the random salt (blocking while gathering entropy)\n");
+// write the private key from offset as the reader drains the pipe,
+// and keep the pipe open until every byte has been read
+// a sealed private key is decrypted one chunk at a time instead
+static enum delivery pipe_stream(
+	int pipe,
+	int inotify_fd,
+	struct inotify_event* events,
+	size_t events_size,
+	const uint8_t* buf,
+	struct sealed* sealed,
+	size_t offset,
+	size_t len,
+	bool* closed)
+{
+	struct pollfd fds[2] =
+	{
+		{.fd = pipe, .events = POLLOUT},
+		{.fd = inotify_fd, .events = POLLIN},
+	};
 
-	sshram_rng(salt, 16);
+	size_t done = offset;
+	int pending;
 
-	if (dgn_catch())
+	while (true)
 	{
-		mem_clean(pass, 257);
-		mem_clean(confirm, 257);
-		munlock(pass, 257);
-		munlock(confirm, 257);
+		if (done < len)
+		{
+			const uint8_t* cur;
+			size_t avail;
 
-		return;
-	}
+			if (sealed != NULL)
+			{
+				cur = sealed_open(sealed, done, &avail);
 
-	// derive password
-	uint8_t hash[32];
+				if (cur == NULL)
+				{
+					return SSHRAM_DELIVERY_ERROR;
+				}
+			}
+			else
+			{
+				cur = buf + done;
+				avail = len - done;
+			}
 
-	err_mlock = mlock(hash, 32);
+			ssize_t ok = write(pipe, cur, avail);
 
-	if (err_mlock != 0)
-	{
-		mem_clean(pass, 257);
-		mem_clean(confirm, 257);
-		munlock(pass, 257);
-		munlock(confirm, 257);
+			if (ok > 0)
+			{
+				done += ok;
 
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
-	}
+				// wipe the plaintext chunk as soon as it is in the pipe
+				if ((sealed != NULL) && ((size_t) ok == avail))
+				{
+					sealed_wipe(sealed);
+				}
+			}
+			else if ((ok == -1) && (errno != EAGAIN))
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+				return SSHRAM_DELIVERY_ERROR;
+			}
+		}
 
-	printf("Deriving password with Argon2...\n");
+		// the reader must have consumed everything before we close the pipe
+		if (ioctl(pipe, FIONREAD, &pending) == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_IOCTL);
+			return SSHRAM_DELIVERY_ERROR;
+		}
 
-	int err_hash = argon2i_hash_raw(
-		100,
-		(1 << 16),
-		1,
-		pass,
-		strlen(pass),
-		salt,
-		16,
-		hash,
-		32);
+		if ((done == len) && (pending == 0))
+		{
+			break;
+		}
 
-	if (err_hash != ARGON2_OK)
-	{
-		mem_clean(pass, 257);
-		mem_clean(confirm, 257);
-		mem_clean(hash, 32);
-		munlock(pass, 257);
-		munlock(confirm, 257);
-		munlock(hash, 32);
+		// the reader left before getting the whole private key
+		if (*closed == true)
+		{
+			return SSHRAM_DELIVERY_ABORTED;
+		}
 
-		dgn_throw(SSHRAM_ERR_ARGON2);
-		return;
-	}
+		fds[0].events = (done < len) ? POLLOUT : 0;
 
-	if (config->verbose == true)
-	{
-		for (int i = 0; i < 32; ++i)
+		if (poll(fds, 2, -1) == -1)
 		{
-			printf("%02x ", hash[i]);
+			if (errno == EINTR)
+			{
+				dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ_INT);
+			}
+			else
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_POLL);
+			}
+
+			return SSHRAM_DELIVERY_ERROR;
 		}
 
-		printf("\n");
-	}
+		if ((fds[1].revents & POLLIN) != 0)
+		{
+			uint32_t mask = pipe_events(inotify_fd, events, events_size);
 
-	mem_clean(pass, 257);
-	mem_clean(confirm, 257);
-	munlock(pass, 257);
-	munlock(confirm, 257);
+			if (dgn_catch())
+			{
+				return SSHRAM_DELIVERY_ERROR;
+			}
 
-	// generate nonce
-	uint8_t nonce[12];
+			if ((mask & IN_CLOSE_NOWRITE) != 0)
+			{
+				*closed = true;
+			}
+		}
+	}
 
-	printf("Generating the random nonce (blocking while gathering entropy)\n");
+	return SSHRAM_DELIVERY_OK;
+}
 
-	sshram_rng(nonce, 12);
+// pre-armed deliveries: the whole private key waits in the pipe buffer, so
+// the reader gets all of it without waiting for us, and our descriptor is
+// closed on its first read so it gets end-of-file too (the pipe and its
+// buffer live on as long as the reader holds it open): compared to the probe
+// byte, the write and the wait for the drain are off the critical path
 
-	if (dgn_catch())
+// open the pipe if needed and make room for the whole private key
+static bool queue_fits(const char* path, int* pipe, size_t len, size_t pipe_max)
+{
+	if (*pipe == -1)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
+		*pipe = open(path, O_RDWR | O_NONBLOCK);
 
-		return;
+		if (*pipe == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
+			return false;
+		}
 	}
 
-	int err_file;
+	// every new pipe gets the default size
+	pipe_grow(*pipe, len, pipe_max);
 
-	// allocate buffers
-	printf("Encoding private key with ChaCha20-Poly1305...\n");
+	int size = fcntl(*pipe, F_GETPIPE_SZ);
 
-	err_file = fseek(config->file_decoded, 0, SEEK_END);
+	return (size != -1) && ((size_t) size >= len);
+}
 
-	if (err_file != 0)
+// fill the pipe with the whole private key
+static void queue_arm(
+	const char* path,
+	int* pipe,
+	const uint8_t* buf,
+	size_t len,
+	size_t pipe_max)
+{
+	if (queue_fits(path, pipe, len, pipe_max) == false)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
+		if (dgn_catch() == false)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+		}
 
-		dgn_throw(SSHRAM_ERR_FSEEK);
 		return;
 	}
 
-	long buf_len = ftell(config->file_decoded);
-	long header_len = 16 + 12 + 16;
-
-	if (buf_len < 2)
+	if (write(*pipe, buf, len) != (ssize_t) len)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-
-		dgn_throw(SSHRAM_ERR_FTELL);
-		return;
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
 	}
+}
 
-	uint8_t* buf_decoded = malloc(buf_len);
+// hand an armed pipe over to its reader, then wait until the reader is done
+static void queue_deliver(
+	int inotify_fd,
+	int pipe,
+	struct inotify_event* events,
+	size_t events_size,
+	struct timespec* time_start)
+{
+	uint32_t mask = 0;
 
-	if (buf_decoded == NULL)
+	// a close read before the first access comes from an earlier reader,
+	// only the ones following it can end this delivery
+	while ((mask & IN_ACCESS) == 0)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
+		mask = pipe_events_from(inotify_fd, events, events_size, IN_ACCESS);
 
-		dgn_throw(SSHRAM_ERR_MALLOC);
-		return;
+		if (dgn_catch())
+		{
+			close(pipe);
+			return;
+		}
 	}
 
-	uint8_t* buf_encoded = malloc(buf_len + header_len);
+	clock_gettime(CLOCK_MONOTONIC, time_start);
 
-	if (buf_encoded == NULL)
+	if (close(pipe) == -1)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-
-		free(buf_decoded);
-
-		dgn_throw(SSHRAM_ERR_MALLOC);
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_FCLOSE);
 		return;
 	}
 
-	// lock memory
-	err_mlock = mlock(buf_decoded, buf_len);
-
-	if (err_mlock != 0)
+	// opening the pipe again before the reader closes it would join it
+	while ((mask & IN_CLOSE_NOWRITE) == 0)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
+		mask |= pipe_events(inotify_fd, events, events_size);
 
-		free(buf_decoded);
-		free(buf_encoded);
+		if (dgn_catch())
+		{
+			return;
+		}
+	}
+}
 
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
+static const char* pass_prompt(enum sshram_pass_reason reason)
+{
+	switch (reason)
+	{
+		case SSHRAM_PASS_NEW:
+		{
+			return "Please enter a password (16-256 bytes, not that of your SSH private key!): ";
+		}
+		case SSHRAM_PASS_CONFIRM:
+		{
+			return "Please confirm this password by typing it one more time: ";
+		}
+		case SSHRAM_PASS_UNLOCK:
+		default:
+		{
+			return "Please enter your password: ";
+		}
 	}
+}
 
-	err_mlock = mlock(buf_encoded, buf_len + header_len);
+// password source prompting on the standard output
+static bool pass_stream(void* data, enum sshram_pass_reason reason, char* pass, size_t size)
+{
+	printf("%s", pass_prompt(reason));
+	fflush(stdout);
 
-	if (err_mlock != 0)
-	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-		munlock(buf_decoded, buf_len);
+	return getpassword(pass, size, (FILE*) data) == pass;
+}
 
-		free(buf_decoded);
-		free(buf_encoded);
+// password source running an askpass program (like ssh-askpass), which gets
+// the prompt as its argument and prints the password on its standard output
+static bool pass_askpass(void* data, enum sshram_pass_reason reason, char* pass, size_t size)
+{
+	const char* program = (const char*) data;
+	int fds[2];
 
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
+	if (pipe(fds) != 0)
+	{
+		return false;
 	}
 
-	// encode SSH private key
-	err_file = fseek(config->file_decoded, 0, SEEK_SET);
+	pid_t pid = fork();
 
-	if (err_file != 0)
+	if (pid == -1)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-		munlock(buf_decoded, buf_len);
-		munlock(buf_encoded, buf_len + header_len);
-
-		free(buf_decoded);
-		free(buf_encoded);
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
 
-		dgn_throw(SSHRAM_ERR_FSEEK);
-		return;
+	if (pid == 0)
+	{
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execlp(program, program, pass_prompt(reason), (char*) NULL);
+		_exit(127);
 	}
 
-	err_file = fread(buf_decoded, 1, buf_len, config->file_decoded);
+	close(fds[1]);
+
+	FILE* file = fdopen(fds[0], "r");
+	bool ok = false;
 
-	if (err_file < 0)
+	if (file == NULL)
 	{
-		mem_clean(hash, 32);
-		mem_clean(buf_decoded, buf_len);
-		munlock(hash, 32);
-		munlock(buf_decoded, buf_len);
-		munlock(buf_encoded, buf_len + header_len);
+		close(fds[0]);
+	}
+	else
+	{
+		// unbuffered, so no copy of the password is left in a stdio buffer
+		setvbuf(file, NULL, _IONBF, 0);
+		ok = (getpassword(pass, size, file) == pass);
+		fclose(file);
+	}
 
-		free(buf_decoded);
-		free(buf_encoded);
+	int status;
 
-		dgn_throw(SSHRAM_ERR_FREAD);
-		return;
-	}
+	while ((waitpid(pid, &status, 0) == -1) && (errno == EINTR));
 
-	uint8_t tag[16];
+	return ok && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
 
-	cf_chacha20poly1305_encrypt(
-		hash,
-		nonce,
-		NULL,
-		0,
-		buf_decoded,
-		buf_len,
-		buf_encoded,
-		tag);
+// password source of reloads, which never ask for a password
+static bool pass_refused(void* data, enum sshram_pass_reason reason, char* pass, size_t size)
+{
+	return false;
+}
 
-	err_file  = fwrite(salt,        1, 16,      config->file_encoded);
-	err_file += fwrite(nonce,       1, 12,      config->file_encoded);
-	err_file += fwrite(tag,         1, 16,      config->file_encoded);
-	err_file += fwrite(buf_encoded, 1, buf_len, config->file_encoded);
+// the password source used for decoding
+static struct sshram_pass config_pass(struct config* config)
+{
+	struct sshram_pass source =
+	{
+		.get = pass_stream,
+		.data = config->file_pass,
+	};
 
-	if (err_file != (buf_len + header_len))
+	if (config->askpass != NULL)
 	{
-		dgn_throw(SSHRAM_ERR_FWRITE);
+		source.get = pass_askpass;
+		source.data = config->askpass;
 	}
 
-	// unlock remaining resources
-	mem_clean(hash, 32);
-	mem_clean(buf_decoded, buf_len);
-	mem_clean(buf_encoded, buf_len);
-	munlock(hash, 32);
-	munlock(buf_decoded, buf_len);
-	munlock(buf_encoded, buf_len + header_len);
-
-	free(buf_decoded);
-	free(buf_encoded);
+	return source;
 }
 
-void sshram_decode(struct config* config)
+static struct sshram_options config_options(struct config* config, struct sshram_cache* cache)
 {
-	// set SIGINT handler
-	const struct sigaction sig_struct =
+	struct sshram_options options =
 	{
-		.sa_handler = sigint_handler,
-		.sa_flags = 0, // interrupt read
+		.alloc = &lockplan_secrets,
+		.cache = cache,
+		.log = stdout,
+		.slot = config->slot,
+		.jobs = config->jobs,
+		.cipher = config->cipher,
+		.compress = config->compress,
+		.verbose = config->verbose,
 	};
 
-	int err_sig = sigaction(SIGINT, &sig_struct, NULL);
+	return options;
+}
 
-	if (err_sig == -1)
+// the encoded data is only locked if the plan allows it
+static struct sshram_options encoded_options(const struct sshram_options* options)
+{
+	struct sshram_options encoded = *options;
+
+	encoded.alloc = &lockplan_encoded;
+
+	return encoded;
+}
+
+// the length of an open file, to plan locked memory before reading it
+static size_t file_size(FILE* file)
+{
+	struct stat file_info;
+
+	if ((fstat(fileno(file), &file_info) != 0) || (file_info.st_size < 0))
 	{
-		dgn_throw(SSHRAM_ERR_DEC_SIGACTION);
-		return;
+		return 0;
 	}
 
-	// get SSH private key length
-	int err_file = fseek(config->file_encoded, 0, SEEK_END);
+	return file_info.st_size;
+}
+
+// read a whole file in a new buffer from the allocator
+static uint8_t* file_read(
+	FILE* file,
+	const struct sshram_options* options,
+	size_t* len)
+{
+	int err_file = fseek(file, 0, SEEK_END);
 
 	if (err_file != 0)
 	{
 		dgn_throw(SSHRAM_ERR_FSEEK);
-		return;
+		return NULL;
 	}
 
-	long header_len = 16 + 12 + 16;
-	long buf_len = ftell(config->file_encoded) - header_len;
+	long file_len = ftell(file);
 
-	if (buf_len < (header_len + 2))
+	if (file_len < 2)
 	{
 		dgn_throw(SSHRAM_ERR_FTELL);
-		return;
+		return NULL;
 	}
 
-	// read salt, nonce, tag
-	err_file = fseek(config->file_encoded, 0, SEEK_SET);
+	err_file = fseek(file, 0, SEEK_SET);
 
 	if (err_file != 0)
 	{
 		dgn_throw(SSHRAM_ERR_FSEEK);
-		return;
+		return NULL;
 	}
 
-	uint8_t salt[16];
-	err_file = fread(salt, 1, 16, config->file_encoded);
+	uint8_t* buf = sshram_alloc(options, file_len);
 
-	if (err_file < 0)
+	if (buf == NULL)
 	{
-		dgn_throw(SSHRAM_ERR_FREAD);
-		return;
+		return NULL;
 	}
 
-	uint8_t nonce[12];
-	err_file = fread(nonce, 1, 12, config->file_encoded);
+	size_t read_len = fread(buf, 1, file_len, file);
 
-	if (err_file < 0)
+	if (ferror(file) != 0)
 	{
+		sshram_release(options, buf, file_len);
+
 		dgn_throw(SSHRAM_ERR_FREAD);
-		return;
+		return NULL;
 	}
 
-	uint8_t tag[16];
-	err_file = fread(tag, 1, 16, config->file_encoded);
+	*len = read_len;
 
-	if (err_file < 0)
-	{
-		dgn_throw(SSHRAM_ERR_FREAD);
-		return;
-	}
+	return buf;
+}
 
-	if (config->verbose == true)
+void sshram_encode(struct config* config)
+{
+	struct sshram_pass source =
 	{
-		printf("salt: ");
-		for (int i = 0; i < 16; ++i)
-		{
-			printf("%02x ", salt[i]);
-		}
-		printf("\n");
+		.get = pass_stream,
+		.data = config->file_pass,
+	};
 
-		printf("nonce: ");
-		for (int i = 0; i < 12; ++i)
-		{
-			printf("%02x ", nonce[i]);
-		}
-		printf("\n");
+	struct sshram_options options = config_options(config, NULL);
+	struct sshram_options options_encoded = encoded_options(&options);
+
+	// fail before asking for a password if the buffers can't be locked
+	size_t plan_len = file_size(config->file_decoded);
+
+	lockplan_need(plan_len, true);
+	lockplan_need(sshram_encode_bound(plan_len), false);
+
+	if (config->compress == true)
+	{
+		lockplan_need(compress_bound(plan_len), true);
+	}
+
+	lockplan_fit(config->verbose);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	// read SSH private key
+	size_t buf_len;
+	uint8_t* buf_decoded = file_read(config->file_decoded, &options, &buf_len);
+
+	if (buf_decoded == NULL)
+	{
+		return;
+	}
+
+	size_t encoded_cap = sshram_encode_bound(buf_len);
+	uint8_t* buf_encoded = sshram_alloc(&options_encoded, encoded_cap);
+
+	if (buf_encoded == NULL)
+	{
+		sshram_release(&options, buf_decoded, buf_len);
+		return;
+	}
+
+	// encode SSH private key
+	size_t encoded_len = sshram_encode_buf(
+		buf_decoded,
+		buf_len,
+		buf_encoded,
+		encoded_cap,
+		&source,
+		&options);
+
+	if (dgn_catch() == false)
+	{
+		size_t err_file = fwrite(buf_encoded, 1, encoded_len, config->file_encoded);
 
-		printf("tag: ");
-		for (int i = 0; i < 16; ++i)
+		if (err_file != encoded_len)
 		{
-			printf("%02x ", tag[i]);
+			dgn_throw(SSHRAM_ERR_FWRITE);
 		}
-		printf("\n");
 	}
 
-	// get password
+	sshram_release(&options, buf_decoded, buf_len);
+	sshram_release(&options_encoded, buf_encoded, encoded_cap);
+
+	if (config->verbose == true)
+	{
+		lockplan_report();
+	}
+}
+
+void sshram_rekey(struct config* config)
+{
+	// read the key tables only, the payload is left untouched
+	int fd = fileno(config->file_encoded);
+	uint8_t header[ENVELOPE_HEADER_LEN];
+	ssize_t err_file = pread(fd, header, ENVELOPE_HEADER_LEN, 0);
+
+	if (err_file == -1)
+	{
+		dgn_throw(SSHRAM_ERR_FREAD);
+		return;
+	}
+
+	if (envelope_detect(header, err_file) == false)
+	{
+		dgn_throw(SSHRAM_ERR_REKEY_LEGACY);
+		return;
+	}
+
+	struct envelope envelope;
+
+	envelope_read(&envelope, header);
+
+	// get current password
 	char pass[257] = {0};
 
 	int err_mlock = mlock(pass, 257);
@@ -531,10 +731,9 @@ void sshram_decode(struct config* config)
 		return;
 	}
 
-	printf("Please enter your password: ");
-	fflush(stdin);
+	printf("Please enter your current password: ");
 
-	char* err_pass = getpassword(pass, 257, stdin);
+	char* err_pass = getpassword(pass, 257, config->file_pass);
 
 	if (err_pass != pass)
 	{
@@ -545,10 +744,10 @@ void sshram_decode(struct config* config)
 		return;
 	}
 
-	// derive password
-	uint8_t hash[32];
+	// unwrap the data key
+	uint8_t key[32] = {0};
 
-	err_mlock = mlock(hash, 32);
+	err_mlock = mlock(key, 32);
 
 	if (err_mlock != 0)
 	{
@@ -561,298 +760,223 @@ void sshram_decode(struct config* config)
 
 	printf("Deriving password with Argon2...\n");
 
-	int err_hash = argon2i_hash_raw(
-		100,
-		(1 << 16),
-		1,
-		pass,
-		strlen(pass),
-		salt,
-		16,
-		hash,
-		32);
+	int unlocked = envelope_unlock(&envelope, pass, config->slot, key, NULL);
+
+	mem_clean(pass, 257);
 
-	if (err_hash != ARGON2_OK)
+	if (dgn_catch())
 	{
-		mem_clean(pass, 257);
-		mem_clean(hash, 32);
 		munlock(pass, 257);
-		munlock(hash, 32);
+		munlock(key, 32);
 
-		dgn_throw(SSHRAM_ERR_ARGON2);
 		return;
 	}
 
-	if (config->verbose == true)
+	if (unlocked < 0)
 	{
-		for (int i = 0; i < 32; ++i)
-		{
-			printf("%02x ", hash[i]);
-		}
+		munlock(pass, 257);
+		munlock(key, 32);
 
-		printf("\n");
+		dgn_throw(SSHRAM_ERR_DEC_UNWRAP);
+		return;
 	}
 
-	mem_clean(pass, 257);
-	munlock(pass, 257);
+	// wrap it again with the new password in the inactive table,
+	// either in place of the unlocked slot or in the first free one
+	uint8_t table = envelope.active ^ 1;
+	int target = unlocked;
 
-	// allocate buffers
-	uint8_t* buf_decoded = malloc(buf_len + 1);
+	memcpy(
+		envelope.tables[table],
+		envelope.tables[envelope.active],
+		sizeof (envelope.tables[0]));
 
-	if (buf_decoded == NULL)
+	if (config->action == SSHRAM_ACTION_ADD_SLOT)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-
-		dgn_throw(SSHRAM_ERR_MALLOC);
-		return;
-	}
+		target = 0;
 
-	uint8_t* buf_encoded = malloc(buf_len);
-
-	if (buf_encoded == NULL)
-	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
+		while ((target < ENVELOPE_SLOTS)
+			&& envelope_slot_used(&(envelope.tables[table][target])))
+		{
+			++target;
+		}
 
-		free(buf_decoded);
+		if (target == ENVELOPE_SLOTS)
+		{
+			mem_clean(key, 32);
+			munlock(pass, 257);
+			munlock(key, 32);
 
-		dgn_throw(SSHRAM_ERR_MALLOC);
-		return;
+			dgn_throw(SSHRAM_ERR_REKEY_SLOTS_FULL);
+			return;
+		}
 	}
 
-	// lock memory
-	err_mlock = mlock(buf_decoded, buf_len + 1);
-
-	if (err_mlock != 0)
+	struct sshram_pass source =
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-
-		free(buf_decoded);
-		free(buf_encoded);
+		.get = pass_stream,
+		.data = config->file_pass,
+	};
 
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
-	}
+	struct sshram_options options = config_options(config, NULL);
 
-	err_mlock = mlock(buf_encoded, buf_len);
+	sshram_pass_new(&source, &options, pass);
 
-	if (err_mlock != 0)
+	if (dgn_catch() == false)
 	{
-		mem_clean(hash, 32);
-		munlock(hash, 32);
-		munlock(buf_decoded, buf_len + 1);
-
-		free(buf_decoded);
-		free(buf_encoded);
-
-		dgn_throw(SSHRAM_ERR_MLOCK);
-		return;
+		sshram_slot_new(&(envelope.tables[table][target]), pass, key, &options);
 	}
 
-	// decode SSH private key
-	err_file = fread(buf_encoded, 1, buf_len, config->file_encoded);
+	mem_clean(pass, 257);
+	mem_clean(key, 32);
+	munlock(pass, 257);
+	munlock(key, 32);
 
-	if (err_file < 0)
+	if (dgn_catch())
 	{
-		mem_clean(hash, 32);
-		mem_clean(buf_encoded, buf_len);
-		munlock(hash, 32);
-		munlock(buf_decoded, buf_len + 1);
-		munlock(buf_encoded, buf_len);
-
-		free(buf_decoded);
-		free(buf_encoded);
-
-		dgn_throw(SSHRAM_ERR_FREAD);
 		return;
 	}
 
-	printf("Decoding private key with ChaCha20-Poly1305...\n");
+	// commit the inactive table before flipping the active table byte,
+	// which is the only write able to change what a reader will use
+	size_t offset = envelope_table_offset(table);
 
-	int err_decode = cf_chacha20poly1305_decrypt(
-		hash,
-		nonce,
-		NULL,
-		0,
-		buf_encoded,
-		buf_len,
-		tag,
-		buf_decoded);
+	envelope_write_table(&envelope, table, header + offset);
 
-	mem_clean(hash, 32);
-	mem_clean(buf_encoded, buf_len);
-	munlock(hash, 32);
-	munlock(buf_encoded, buf_len);
-	free(buf_encoded);
+	err_file = pwrite(fd, header + offset, ENVELOPE_TABLE_LEN, offset);
 
-	if (err_decode != 0)
+	if (err_file != ENVELOPE_TABLE_LEN)
 	{
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-
-		dgn_throw(SSHRAM_ERR_DEC_CHACHAPOLY);
+		dgn_throw(SSHRAM_ERR_FWRITE);
 		return;
 	}
 
-	if (config->verbose == true)
+	if (fdatasync(fd) != 0)
 	{
-		buf_decoded[buf_len] = '\0';
-		printf("%s\n", buf_decoded);
+		dgn_throw(SSHRAM_ERR_FSYNC);
+		return;
 	}
 
-	// build key file path
-	char* home = getenv("HOME");
+	err_file = pwrite(fd, &table, 1, ENVELOPE_ACTIVE_OFFSET);
 
-	if (home == NULL)
+	if (err_file != 1)
 	{
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-
-		dgn_throw(SSHRAM_ERR_ENV);
+		dgn_throw(SSHRAM_ERR_FWRITE);
 		return;
 	}
 
-	int path_len = strlen(home) + strlen("/.ssh/") + strlen(config->key_name);
-	char* path = malloc(path_len + 1);
-
-	if (path == NULL)
+	if (fdatasync(fd) != 0)
 	{
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-
-		dgn_throw(SSHRAM_ERR_MALLOC);
+		dgn_throw(SSHRAM_ERR_FSYNC);
 		return;
 	}
 
-	int err_path = snprintf(path, path_len + 1, "%s/.ssh/%s", home, config->key_name);
+	// the active byte is not authenticated: overwrite the old table too, or
+	// flipping the byte back would unlock the file with the old password
+	err_file = pwrite(fd, header + offset, ENVELOPE_TABLE_LEN, envelope_table_offset(envelope.active));
 
-	if (err_path != path_len)
+	if (err_file != ENVELOPE_TABLE_LEN)
 	{
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-		free(path);
-
-		dgn_throw(SSHRAM_ERR_DEC_PATH_LEN);
+		dgn_throw(SSHRAM_ERR_FWRITE);
 		return;
 	}
 
-	// check if the pipe already exists, create it if needed
-	struct stat file_info = {0};
-
-	err_file = stat(path, &file_info);
-
-	// file exists
-	if (err_file != -1)
+	if (fdatasync(fd) != 0)
 	{
-		// can't continue because it's not a pipe
-		if (!S_ISFIFO(file_info.st_mode))
-		{
-			mem_clean(buf_decoded, buf_len + 1);
-			munlock(buf_decoded, buf_len + 1);
-			free(buf_decoded);
-			free(path);
+		dgn_throw(SSHRAM_ERR_FSYNC);
+		return;
+	}
 
-			dgn_throw(SSHRAM_ERR_DEC_PASUNEPIPE);
-			return;
-		}
+	if (config->action == SSHRAM_ACTION_ADD_SLOT)
+	{
+		printf("Password added in key slot %d\n", target);
 	}
-	// file does not exist
 	else
 	{
-		// create named pipe
-		int err_pipe = mkfifo(path, S_IRUSR | S_IWUSR);
-
-		if (err_pipe != 0)
-		{
-			mem_clean(buf_decoded, buf_len + 1);
-			munlock(buf_decoded, buf_len + 1);
-			free(buf_decoded);
-			free(path);
-
-			dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
-			return;
-		}
+		printf("Password changed in key slot %d\n", target);
 	}
+}
 
-	int inotify_fd = inotify_init();
+// decode an encoded buffer of the allocator, which is released,
+// printing the library messages to log unless it is NULL
+static uint8_t* decode_buf(
+	struct config* config,
+	const struct sshram_pass* source,
+	FILE* log,
+	uint8_t* buf_encoded,
+	size_t encoded_len,
+	struct sshram_cache* cache,
+	long* len)
+{
+	struct sshram_options options = config_options(config, cache);
 
-	if (inotify_fd == -1)
-	{
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-		free(path);
+	options.log = log;
 
-		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
-		return;
-	}
+	struct sshram_options options_encoded = encoded_options(&options);
 
-	int inotify_watch_fd = inotify_add_watch(inotify_fd, path, IN_ACCESS);
+	size_t plain_len;
+	uint8_t* buf_decoded = sshram_decode_buf(
+		buf_encoded,
+		encoded_len,
+		&plain_len,
+		source,
+		&options);
 
-	if (inotify_watch_fd == -1)
-	{
-		close(inotify_fd);
-		mem_clean(buf_decoded, buf_len + 1);
-		munlock(buf_decoded, buf_len + 1);
-		free(buf_decoded);
-		free(path);
+	sshram_release(&options_encoded, buf_encoded, encoded_len);
 
-		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_ADD_WATCH);
-		return;
-	}
+	*len = plain_len;
 
-	// allocate a large enough inotify event buffer
-	size_t inotify_event_buf_size = (buf_len - 1) * (sizeof (struct inotify_event));
-	struct inotify_event* inotify_event_buf = malloc(inotify_event_buf_size);
+	return buf_decoded;
+}
 
-	if (inotify_event_buf == NULL)
-	{
-		decode_run = 0;
-		dgn_throw(SSHRAM_ERR_MALLOC);
-		return;
-	}
+static uint8_t* decode_file(
+	struct config* config,
+	const struct sshram_pass* source,
+	FILE* log,
+	FILE* file,
+	struct sshram_cache* cache,
+	long* len)
+{
+	struct sshram_options options = config_options(config, cache);
+	struct sshram_options options_encoded = encoded_options(&options);
 
-	// blocking, no-confirmation key transmission using inotify
-	int pipe;
-	ssize_t err_loop;
+	size_t encoded_len;
+	uint8_t* buf_encoded = file_read(file, &options_encoded, &encoded_len);
 
-	if (decode_run == 1)
+	if (buf_encoded == NULL)
 	{
-		printf("Entering transmission loop\n");
+		return NULL;
 	}
 
-	while (decode_run == 1)
-	{
-		// we *must* open in read-write mode to get a non-blocking descriptor
-		// because unix pipes must be opened in read or read/write mode first
-		// or we will not be able to open without non-blocking
-		pipe = open(path, O_RDWR | O_NONBLOCK);
-
-		if (pipe == -1)
-		{
-			dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
-			break;
-		}
+	return decode_buf(config, source, log, buf_encoded, encoded_len, cache, len);
+}
 
-		// send the first character of the private key to be able to detect reads
-		err_loop = write(pipe, buf_decoded, 1);
+static uint64_t elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+	return ((end->tv_sec - start->tv_sec) * 1000000000ull)
+		+ end->tv_nsec - start->tv_nsec;
+}
 
-		if (err_loop != 1)
-		{
-			dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
-			break;
-		}
+// wait for the probe byte to be read, returns false if the encoded file
+// changed in the meantime (the reader always has priority)
+static bool wait_probe(
+	int inotify_fd,
+	int reload_fd,
+	struct inotify_event* events,
+	size_t events_size)
+{
+	// poll ignores negative file descriptors
+	struct pollfd fds[2] =
+	{
+		{.fd = inotify_fd, .events = POLLIN},
+		{.fd = reload_fd, .events = POLLIN},
+	};
 
-		// wait for read
-		err_loop = read(inotify_fd, inotify_event_buf, sizeof (struct inotify_event));
+	uint32_t mask;
 
-		if (err_loop == -1)
+	while (true)
+	{
+		if (poll(fds, 2, -1) == -1)
 		{
 			if (errno == EINTR)
 			{
@@ -860,74 +984,2247 @@ void sshram_decode(struct config* config)
 			}
 			else
 			{
-				dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ);
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_POLL);
 			}
 
-			break;
+			return false;
 		}
 
-		if (decode_run == 0)
+		if ((fds[0].revents & POLLIN) != 0)
 		{
-			break;
-		}
-
-		// write the rest of the private key
-		err_loop = write(pipe, buf_decoded + 1, buf_len - 1);
+			mask = pipe_events(inotify_fd, events, events_size);
 
-		if (err_loop != ((ssize_t) buf_len - 1))
+			if (dgn_catch() || ((mask & IN_ACCESS) != 0))
+			{
+				return !dgn_catch();
+			}
+		}
+		else if ((fds[1].revents & POLLIN) != 0)
 		{
-			dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
-			break;
+			return false;
 		}
+	}
+}
 
-		// close pipe to simulate end-of-file
-		err_file = close(pipe);
+// decode the encoded file again if it was replaced on disk,
+// keeping the current private key if anything goes wrong
+static bool reload_file(
+	struct config* config,
+	int reload_fd,
+	const char* name,
+	struct sshram_cache* derived,
+	uint8_t** buf,
+	long* len)
+{
+	union
+	{
+		struct inotify_event event;
+		char buf[SSHRAM_INOTIFY_EVENTS * (sizeof (struct inotify_event) + NAME_MAX + 1)];
+	} events;
 
-		if (err_file == -1)
-		{
-			dgn_throw(SSHRAM_ERR_DEC_PIPE_FCLOSE);
-			break;
-		}
+	bool changed = false;
+	ssize_t events_len;
 
-		// wait for read
-		err_loop = read(inotify_fd, inotify_event_buf, inotify_event_buf_size);
+	// drain the non-blocking inotify descriptor
+	while ((events_len = read(reload_fd, &events, sizeof (events))) > 0)
+	{
+		char* cur = events.buf;
 
-		if (err_loop == -1)
+		while (cur < (events.buf + events_len))
 		{
-			if (errno == EINTR)
-			{
-				dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ_INT);
-			}
-			else
+			struct inotify_event* event = (struct inotify_event*) cur;
+
+			if ((event->len > 0) && (strcmp(event->name, name) == 0))
 			{
-				dgn_throw(SSHRAM_ERR_DEC_INOTIFY_READ);
+				changed = true;
 			}
 
-			break;
+			cur += (sizeof (struct inotify_event)) + event->len;
 		}
+	}
 
-		// success!
-		printf("Private key transmitted\n");
+	if (changed == false)
+	{
+		return false;
 	}
 
-	if (config->keep_pipe == false)
+	struct timespec time_start;
+	struct timespec time_end;
+	long new_len;
+	uint8_t* new_buf = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+	// the serving loop can't wait for a password: only files opening with
+	// the derived password kept in memory are reloaded, and it can't wait
+	// for stdio either: the outcome is only reported through the log ring
+	struct sshram_pass source =
 	{
-		err_file = unlink(path);
+		.get = pass_refused,
+		.data = NULL,
+	};
 
-		if (err_file == -1)
-		{
-			dgn_throw(SSHRAM_ERR_DEC_PIPE_UNLINK);
-		}
+	FILE* file = fopen(config->path_encoded, "r");
+
+	if (file != NULL)
+	{
+		new_buf = decode_file(config, &source, NULL, file, derived, &new_len);
+		fclose(file);
 	}
 
-	// cleanup
-	inotify_rm_watch(inotify_fd, inotify_watch_fd);
-	close(inotify_fd);
-	mem_clean(buf_decoded, buf_len + 1);
-	munlock(buf_decoded, buf_len + 1);
-	free(inotify_event_buf);
-	free(buf_decoded);
-	free(path);
+	if (new_buf == NULL)
+	{
+		logring_push(LOGRING_RELOAD_FAILED, 0, 0);
+		dgn_reset();
 
-	printf("Exiting normally\n");
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+	// there is no plaintext to release when the private key is sealed
+	if (*buf != NULL)
+	{
+		lockplan_release(*buf, *len + 1);
+	}
+
+	*buf = new_buf;
+	*len = new_len;
+
+	// do not keep the heap growth of every reload
+	malloc_trim(0);
+
+	logring_push(LOGRING_RELOADED, new_len, elapsed_ns(&time_start, &time_end));
+
+	return true;
+}
+
+// seal the private key under a new ephemeral key and release the plaintext
+static void decode_seal(struct sealed* sealed, uint8_t** buf, long len)
+{
+	sealed_free(sealed);
+	sshram_rng(sealed->key, 32);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	sealed_seal(sealed, *buf, len);
+
+	if (dgn_catch())
+	{
+		mem_clean(sealed->key, 32);
+		return;
+	}
+
+	lockplan_release(*buf, len + 1);
+
+	*buf = NULL;
+}
+
+enum serve_state
+{
+	SSHRAM_SERVE_ARMED,
+	SSHRAM_SERVE_STREAMING,
+	SSHRAM_SERVE_CLOSING,
+};
+
+// one of several named pipes, each serving its own private key or sharing one
+struct serve_pipe
+{
+	char* path;
+	uint8_t* buf;
+	size_t len;
+	int pipe;
+	int watch;
+	enum serve_state state;
+	size_t done;
+	size_t deliveries;
+	struct timespec time_start;
+	// the path is a named pipe to remove when exiting
+	bool fifo;
+};
+
+// build the path of the named pipe in ~/.ssh, absolute paths are kept
+static char* serve_path(const char* name)
+{
+	if (name[0] == '/')
+	{
+		char* path = strdup(name);
+
+		if (path == NULL)
+		{
+			dgn_throw(SSHRAM_ERR_MALLOC);
+		}
+
+		return path;
+	}
+
+	char* home = getenv("HOME");
+
+	if (home == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_ENV);
+		return NULL;
+	}
+
+	char* path = NULL;
+
+	if (asprintf(&path, "%s/.ssh/%s", home, name) == -1)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return NULL;
+	}
+
+	return path;
+}
+
+// replace the names of the pipes with their paths and create them, the
+// first *created paths must be given to serve_remove()
+static void serve_create(struct serve_pipe* serves, size_t count, size_t* created)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		char* path = serve_path(serves[i].path);
+
+		if (path == NULL)
+		{
+			return;
+		}
+
+		serves[i].path = path;
+		++(*created);
+
+		// two pipes with the same path would steal each other's readers
+		for (size_t k = 0; k < i; ++k)
+		{
+			if (strcmp(serves[k].path, path) == 0)
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_NAME);
+				return;
+			}
+		}
+
+		struct stat file_info = {0};
+
+		if (stat(path, &file_info) != -1)
+		{
+			if (!S_ISFIFO(file_info.st_mode))
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PASUNEPIPE);
+				return;
+			}
+		}
+		else if (mkfifo(path, S_IRUSR | S_IWUSR) != 0)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
+			return;
+		}
+
+		serves[i].fifo = true;
+	}
+}
+
+static void serve_remove(struct serve_pipe* serves, size_t created, bool keep_pipe)
+{
+	for (size_t i = 0; i < created; ++i)
+	{
+		if ((keep_pipe == false)
+			&& (serves[i].fifo == true)
+			&& (unlink(serves[i].path) == -1)
+			&& (dgn_catch() == false))
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_UNLINK);
+		}
+
+		free(serves[i].path);
+	}
+}
+
+// open the pipe and write the probe byte, to detect the next reader
+static bool serve_arm(struct serve_pipe* serve, size_t pipe_max)
+{
+	serve->pipe = open(serve->path, O_RDWR | O_NONBLOCK);
+
+	if (serve->pipe == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
+		return false;
+	}
+
+	pipe_grow(serve->pipe, serve->len, pipe_max);
+
+	if (write(serve->pipe, serve->buf, 1) != 1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+		return false;
+	}
+
+	serve->state = SSHRAM_SERVE_ARMED;
+	serve->done = 1;
+
+	return true;
+}
+
+// write what the pipe can take, and close it once the reader has everything
+static bool serve_step(struct serve_pipe* serve)
+{
+	if (serve->done < serve->len)
+	{
+		ssize_t ok = write(serve->pipe, serve->buf + serve->done, serve->len - serve->done);
+
+		if (ok > 0)
+		{
+			serve->done += ok;
+		}
+		else if ((ok == -1) && (errno != EAGAIN))
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+			return false;
+		}
+	}
+
+	int pending;
+
+	if (ioctl(serve->pipe, FIONREAD, &pending) == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_IOCTL);
+		return false;
+	}
+
+	if ((serve->done == serve->len) && (pending == 0))
+	{
+		struct timespec time_end;
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+		logring_push(LOGRING_TRANSMITTED, serve->len, elapsed_ns(&(serve->time_start), &time_end));
+		++(serve->deliveries);
+
+		// close pipe to simulate end-of-file
+		if (close(serve->pipe) == -1)
+		{
+			serve->pipe = -1;
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FCLOSE);
+			return false;
+		}
+
+		serve->pipe = -1;
+		serve->state = SSHRAM_SERVE_CLOSING;
+	}
+
+	return true;
+}
+
+// react to a read or a close on one of the pipes
+static bool serve_event(struct serve_pipe* serve, uint32_t mask, size_t pipe_max)
+{
+	switch (serve->state)
+	{
+		case SSHRAM_SERVE_ARMED:
+		{
+			if ((mask & IN_ACCESS) != 0)
+			{
+				serve->state = SSHRAM_SERVE_STREAMING;
+				clock_gettime(CLOCK_MONOTONIC, &(serve->time_start));
+			}
+
+			return true;
+		}
+		case SSHRAM_SERVE_STREAMING:
+		{
+			// the reader left before getting the whole private key
+			if ((mask & IN_CLOSE_NOWRITE) != 0)
+			{
+				logring_push(LOGRING_ABORTED, 0, 0);
+				close(serve->pipe);
+
+				return serve_arm(serve, pipe_max);
+			}
+
+			return true;
+		}
+		case SSHRAM_SERVE_CLOSING:
+		{
+			// the reader got end-of-file, the pipe can be re-opened
+			if ((mask & IN_CLOSE_NOWRITE) != 0)
+			{
+				return serve_arm(serve, pipe_max);
+			}
+
+			return true;
+		}
+	}
+
+	return true;
+}
+
+// serve every private key from a single loop, without blocking on any reader
+static void serve_loop(struct serve_pipe* serves, size_t count, bool syslog)
+{
+	int inotify_fd = inotify_init();
+
+	if (inotify_fd == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
+		return;
+	}
+
+	size_t pipe_max = pipe_max_size();
+	size_t events_size = SSHRAM_INOTIFY_EVENTS * (sizeof (struct inotify_event));
+	struct inotify_event* events = malloc(events_size);
+	struct pollfd* fds = malloc((count + 1) * (sizeof (struct pollfd)));
+	size_t* polled = malloc(count * (sizeof (size_t)));
+
+	if ((events == NULL) || (fds == NULL) || (polled == NULL))
+	{
+		free(events);
+		free(fds);
+		free(polled);
+		close(inotify_fd);
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		serves[i].watch = inotify_add_watch(
+			inotify_fd,
+			serves[i].path,
+			IN_ACCESS | IN_CLOSE_NOWRITE);
+
+		if (serves[i].watch == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_INOTIFY_ADD_WATCH);
+			break;
+		}
+
+		if (serve_arm(&(serves[i]), pipe_max) == false)
+		{
+			break;
+		}
+	}
+
+	if (dgn_catch() == false)
+	{
+		printf("Entering transmission loop for %zu private keys\n", count);
+		logring_start(syslog);
+	}
+
+	while ((decode_run == 1) && (dgn_catch() == false))
+	{
+		// only pipes with bytes left to write wait for room
+		size_t polled_count = 0;
+
+		fds[0].fd = inotify_fd;
+		fds[0].events = POLLIN;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if ((serves[i].state == SSHRAM_SERVE_STREAMING) && (serves[i].done < serves[i].len))
+			{
+				fds[polled_count + 1].fd = serves[i].pipe;
+				fds[polled_count + 1].events = POLLOUT;
+				polled[polled_count] = i;
+				++polled_count;
+			}
+		}
+
+		if (poll(fds, polled_count + 1, -1) == -1)
+		{
+			dgn_throw((errno == EINTR) ? SSHRAM_ERR_DEC_INOTIFY_READ_INT : SSHRAM_ERR_DEC_PIPE_POLL);
+			break;
+		}
+
+		if ((fds[0].revents & POLLIN) != 0)
+		{
+			ssize_t len = read(inotify_fd, events, events_size);
+
+			if (len == -1)
+			{
+				dgn_throw((errno == EINTR) ? SSHRAM_ERR_DEC_INOTIFY_READ_INT : SSHRAM_ERR_DEC_INOTIFY_READ);
+				break;
+			}
+
+			char* cur = (char*) events;
+
+			while ((cur < ((char*) events + len)) && (dgn_catch() == false))
+			{
+				struct inotify_event* event = (struct inotify_event*) cur;
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					if (serves[i].watch == event->wd)
+					{
+						serve_event(&(serves[i]), event->mask, pipe_max);
+						break;
+					}
+				}
+
+				cur += (sizeof (struct inotify_event)) + event->len;
+			}
+		}
+
+		// reads wake us up through inotify, writes through poll
+		for (size_t i = 0; (i < count) && (dgn_catch() == false); ++i)
+		{
+			if (serves[i].state == SSHRAM_SERVE_STREAMING)
+			{
+				serve_step(&(serves[i]));
+			}
+		}
+	}
+
+	logring_stop();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		printf("%zu deliveries to %s\n", serves[i].deliveries, serves[i].path);
+
+		if (serves[i].pipe != -1)
+		{
+			close(serves[i].pipe);
+		}
+
+		if (serves[i].watch != -1)
+		{
+			inotify_rm_watch(inotify_fd, serves[i].watch);
+		}
+	}
+
+	free(events);
+	free(fds);
+	free(polled);
+	close(inotify_fd);
+}
+
+// remove the named pipe published by decode_lazy() when giving up
+static void decode_unpublish(struct config* config)
+{
+	if (config->keep_pipe == true)
+	{
+		return;
+	}
+
+	char* path = serve_path(config->key_name);
+
+	if (path != NULL)
+	{
+		unlink(path);
+		free(path);
+	}
+}
+
+// publish the named pipe before the password is asked, and block until a
+// reader opens it: the returned descriptor holds the pipe open, so the reader
+// waits for the private key instead of failing while it is being unlocked
+static int decode_lazy(struct config* config)
+{
+	char* path = serve_path(config->key_name);
+
+	if (path == NULL)
+	{
+		return -1;
+	}
+
+	struct stat file_info = {0};
+
+	if (stat(path, &file_info) != -1)
+	{
+		if (!S_ISFIFO(file_info.st_mode))
+		{
+			free(path);
+			dgn_throw(SSHRAM_ERR_DEC_PASUNEPIPE);
+			return -1;
+		}
+	}
+	else if (mkfifo(path, S_IRUSR | S_IWUSR) != 0)
+	{
+		free(path);
+		dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
+		return -1;
+	}
+
+	int pipe = open(path, O_RDWR | O_NONBLOCK);
+
+	if (pipe == -1)
+	{
+		free(path);
+		dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
+		return -1;
+	}
+
+	// watched after our own open, so the first event comes from a reader
+	size_t events_size = SSHRAM_INOTIFY_EVENTS * (sizeof (struct inotify_event));
+	struct inotify_event* events = malloc(events_size);
+	int inotify_fd = inotify_init();
+
+	if ((events == NULL) || (inotify_fd == -1))
+	{
+		dgn_throw((events == NULL) ? SSHRAM_ERR_MALLOC : SSHRAM_ERR_DEC_INOTIFY_INIT);
+	}
+	else if (inotify_add_watch(inotify_fd, path, IN_OPEN) == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_ADD_WATCH);
+	}
+	else
+	{
+		printf("Waiting for a reader on %s before unlocking the private key\n", path);
+		fflush(stdout);
+
+		while ((pipe_events(inotify_fd, events, events_size) & IN_OPEN) == 0)
+		{
+			if (dgn_catch())
+			{
+				break;
+			}
+		}
+	}
+
+	if (inotify_fd != -1)
+	{
+		close(inotify_fd);
+	}
+
+	free(events);
+	free(path);
+
+	if (dgn_catch())
+	{
+		close(pipe);
+		decode_unpublish(config);
+		return -1;
+	}
+
+	return pipe;
+}
+
+// a memory counter of /proc/self/status, in KiB
+static size_t status_kib(const char* field)
+{
+	FILE* file = fopen("/proc/self/status", "r");
+	size_t field_len = strlen(field);
+	unsigned long kib = 0;
+	char line[128];
+
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	while (fgets(line, sizeof (line), file) != NULL)
+	{
+		if ((strncmp(line, field, field_len) == 0) && (line[field_len] == ':'))
+		{
+			sscanf(line + field_len + 1, "%lu", &kib);
+			break;
+		}
+	}
+
+	fclose(file);
+
+	return kib;
+}
+
+// the serving phase lasts for days and only needs the locked private keys:
+// close the encoded file and give the heap growth of the key derivation and
+// decryption back to the system before entering it
+static void decode_compact(struct config* config)
+{
+	if (config->file_encoded != NULL)
+	{
+		fclose(config->file_encoded);
+		config->file_encoded = NULL;
+	}
+
+	if ((config->file_pass != NULL) && (config->file_pass != stdin))
+	{
+		fclose(config->file_pass);
+		config->file_pass = NULL;
+	}
+
+	malloc_trim(0);
+
+	printf(
+		"Serving with %zu KiB resident, of which %zu KiB locked\n",
+		status_kib("VmRSS"),
+		status_kib("VmLck"));
+}
+
+// serve one private key from several named pipes, in a single loop
+static void decode_names(struct config* config, uint8_t* buf, size_t len)
+{
+	size_t count = config->names_count;
+	struct serve_pipe* serves = calloc(count, sizeof (struct serve_pipe));
+
+	if (serves == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		serves[i].path = config->names[i];
+		serves[i].buf = buf;
+		serves[i].len = len;
+		serves[i].pipe = -1;
+		serves[i].watch = -1;
+	}
+
+	size_t created = 0;
+
+	serve_create(serves, count, &created);
+
+	if (dgn_catch() == false)
+	{
+		serve_loop(serves, count, config->syslog);
+	}
+
+	serve_remove(serves, created, config->keep_pipe);
+	free(serves);
+}
+
+// the small key region is released with the process
+static void decode_free(void* buf)
+{
+	if (lockplan_small_owns(buf) == false)
+	{
+		free(buf);
+	}
+}
+
+void sshram_decode(struct config* config)
+{
+	// set SIGINT handler
+	const struct sigaction sig_struct =
+	{
+		.sa_handler = sigint_handler,
+		.sa_flags = 0, // interrupt read
+	};
+
+	int err_sig = sigaction(SIGINT, &sig_struct, NULL);
+
+	if (err_sig == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_SIGACTION);
+		return;
+	}
+
+	// the encoded file may not have been found yet, on removable media
+	char media_path[PATH_MAX];
+	size_t plan_len;
+
+	if (config->media_count > 0)
+	{
+		media_wait(config->media, config->media_count, config->path_encoded, media_path, &plan_len);
+
+		if (dgn_catch())
+		{
+			return;
+		}
+	}
+	else
+	{
+		plan_len = file_size(config->file_encoded);
+	}
+
+	// fail before asking for a password if the buffers can't be locked,
+	// the decoded private key is never larger than the encoded file
+	bool small = lockplan_small(plan_len);
+
+	if (small == false)
+	{
+		lockplan_need(plan_len, false);
+		lockplan_need(plan_len + 1, true);
+	}
+
+	if ((config->watch == true) && (small == false))
+	{
+		// a reloaded private key is decoded before the old one is released
+		lockplan_need(plan_len, false);
+		lockplan_need(plan_len + 1, true);
+		lockplan_need(sizeof (struct sshram_cache), true);
+	}
+
+	if (config->sealed == true)
+	{
+		lockplan_need(SEALED_CHUNK_LEN, true);
+		lockplan_need(sizeof (struct sealed), true);
+	}
+
+	if (config->socket != NULL)
+	{
+		lockplan_need(plan_len, true);
+	}
+
+	lockplan_fit(config->verbose);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	// read the whole encoded file before anything else, so the media can go
+	struct sshram_options media_options = config_options(config, NULL);
+	struct sshram_options media_encoded = encoded_options(&media_options);
+	uint8_t* media_buf = NULL;
+	size_t media_len;
+
+	if (config->media_count > 0)
+	{
+		media_buf = media_load(media_path, &media_encoded, &media_len);
+
+		if (media_buf == NULL)
+		{
+			return;
+		}
+
+		printf("The removable media isn't needed anymore\n");
+
+		// the pipe is named after the encoded file, without its extension
+		if (config->key_name == NULL)
+		{
+			size_t path_len = strlen(media_path);
+			size_t ext_len = strlen(MEDIA_EXTENSION);
+
+			if ((path_len > ext_len)
+				&& (strcmp(media_path + path_len - ext_len, MEDIA_EXTENSION) == 0))
+			{
+				media_path[path_len - ext_len] = '\0';
+			}
+
+			config->key_name = basename(media_path);
+		}
+	}
+
+	// the password is only asked once somebody needs the private key
+	int lazy = -1;
+
+	if (config->lazy == true)
+	{
+		lazy = decode_lazy(config);
+
+		if (dgn_catch())
+		{
+			if (media_buf != NULL)
+			{
+				sshram_release(&media_encoded, media_buf, media_len);
+			}
+
+			return;
+		}
+	}
+
+	// keep the derived password to reload the encoded file
+	struct sshram_cache derived = {0};
+	struct sshram_cache* cache = NULL;
+
+	if (config->watch == true)
+	{
+		int err_mlock = mlock(&derived, sizeof (derived));
+
+		if (err_mlock != 0)
+		{
+			if (lazy != -1)
+			{
+				close(lazy);
+			}
+
+			if (media_buf != NULL)
+			{
+				sshram_release(&media_encoded, media_buf, media_len);
+			}
+
+			dgn_throw(SSHRAM_ERR_MLOCK);
+			return;
+		}
+
+		cache = &derived;
+	}
+
+	long buf_len;
+	uint8_t* buf_decoded;
+
+	struct sshram_pass source = config_pass(config);
+
+	if (media_buf != NULL)
+	{
+		buf_decoded = decode_buf(config, &source, stdout, media_buf, media_len, cache, &buf_len);
+	}
+	else
+	{
+		buf_decoded = decode_file(config, &source, stdout, config->file_encoded, cache, &buf_len);
+	}
+
+	if (buf_decoded == NULL)
+	{
+		// the waiting reader gets end-of-file
+		if (lazy != -1)
+		{
+			close(lazy);
+			decode_unpublish(config);
+		}
+
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+
+		return;
+	}
+
+	// reloads open the encoded file again from its path
+	decode_compact(config);
+
+	// serve the private key from a FUSE filesystem instead of a named pipe
+	if (config->mountpoint != NULL)
+	{
+		struct keyfs_entry entry =
+		{
+			.name = config->key_name,
+			.buf = buf_decoded,
+			.len = buf_len,
+		};
+
+		logring_start(config->syslog);
+
+		if (dgn_catch() == false)
+		{
+			keyfs_serve(config->mountpoint, &entry, 1);
+			logring_stop();
+		}
+
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+
+		if (config->verbose == true)
+		{
+			lockplan_report();
+		}
+
+		printf("Exiting normally\n");
+		return;
+	}
+
+	// hand the private key to cooperating clients over a Unix socket
+	if (config->socket != NULL)
+	{
+		logring_start(config->syslog);
+
+		if (dgn_catch() == false)
+		{
+			keysock_serve(config->socket, buf_decoded, buf_len);
+			logring_stop();
+		}
+
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+
+		if (config->verbose == true)
+		{
+			lockplan_report();
+		}
+
+		printf("Exiting normally\n");
+		return;
+	}
+
+	// publish the same private key in several places
+	if (config->names_count > 1)
+	{
+		decode_names(config, buf_decoded, buf_len);
+
+		lockplan_release(buf_decoded, buf_len + 1);
+
+		if (dgn_catch() == false)
+		{
+			if (config->verbose == true)
+			{
+				lockplan_report();
+			}
+
+			printf("Exiting normally\n");
+		}
+
+		return;
+	}
+
+	// build key file path, absolute names are used as they are
+	char* home = "";
+	char* dir = "";
+
+	if (config->key_name[0] != '/')
+	{
+		home = getenv("HOME");
+		dir = "/.ssh/";
+	}
+
+	if (home == NULL)
+	{
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+
+		dgn_throw(SSHRAM_ERR_ENV);
+		return;
+	}
+
+	int path_len = strlen(home) + strlen(dir) + strlen(config->key_name);
+	char* path = lockplan_small_path(path_len + 1);
+
+	if (path == NULL)
+	{
+		path = malloc(path_len + 1);
+	}
+
+	if (path == NULL)
+	{
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	int err_path = snprintf(path, path_len + 1, "%s%s%s", home, dir, config->key_name);
+
+	if (err_path != path_len)
+	{
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+		decode_free(path);
+
+		dgn_throw(SSHRAM_ERR_DEC_PATH_LEN);
+		return;
+	}
+
+	// check if the pipe already exists, create it if needed
+	struct stat file_info = {0};
+
+	int err_file = stat(path, &file_info);
+
+	// file exists
+	if (err_file != -1)
+	{
+		// can't continue because it's not a pipe
+		if (!S_ISFIFO(file_info.st_mode))
+		{
+			lockplan_release(buf_decoded, buf_len + 1);
+			mem_clean(&derived, sizeof (derived));
+			munlock(&derived, sizeof (derived));
+			decode_free(path);
+
+			dgn_throw(SSHRAM_ERR_DEC_PASUNEPIPE);
+			return;
+		}
+	}
+	// file does not exist
+	else
+	{
+		// create named pipe
+		int err_pipe = mkfifo(path, S_IRUSR | S_IWUSR);
+
+		if (err_pipe != 0)
+		{
+			lockplan_release(buf_decoded, buf_len + 1);
+			mem_clean(&derived, sizeof (derived));
+			munlock(&derived, sizeof (derived));
+			decode_free(path);
+
+			dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
+			return;
+		}
+	}
+
+	int inotify_fd = inotify_init();
+
+	if (inotify_fd == -1)
+	{
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+		decode_free(path);
+
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
+		return;
+	}
+
+	int inotify_watch_fd = inotify_add_watch(
+		inotify_fd,
+		path,
+		IN_ACCESS | IN_CLOSE_NOWRITE);
+
+	if (inotify_watch_fd == -1)
+	{
+		close(inotify_fd);
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+		decode_free(path);
+
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_ADD_WATCH);
+		return;
+	}
+
+	// allocate a large enough inotify event buffer
+	size_t inotify_event_buf_size =
+		MIN(buf_len - 1, SSHRAM_INOTIFY_EVENTS) * (sizeof (struct inotify_event));
+	struct inotify_event* inotify_event_buf =
+		(struct inotify_event*) lockplan_small_events(inotify_event_buf_size);
+
+	if (inotify_event_buf == NULL)
+	{
+		inotify_event_buf = malloc(inotify_event_buf_size);
+	}
+
+	if (inotify_event_buf == NULL)
+	{
+		inotify_rm_watch(inotify_fd, inotify_watch_fd);
+		close(inotify_fd);
+		lockplan_release(buf_decoded, buf_len + 1);
+		mem_clean(&derived, sizeof (derived));
+		munlock(&derived, sizeof (derived));
+		decode_free(path);
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	// watch the directory of the encoded file, to catch atomic replacements
+	int reload_fd = -1;
+	char* reload_dir = NULL;
+	char* reload_name = NULL;
+
+	if (config->watch == true)
+	{
+		reload_fd = inotify_init1(IN_NONBLOCK);
+		reload_dir = strdup(config->path_encoded);
+
+		if ((reload_fd == -1) || (reload_dir == NULL))
+		{
+			decode_run = 0;
+			dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
+		}
+		else
+		{
+			reload_name = strrchr(reload_dir, '/');
+
+			if (reload_name == NULL)
+			{
+				reload_name = reload_dir;
+			}
+			else
+			{
+				*reload_name = '\0';
+				++reload_name;
+			}
+
+			int err_watch = inotify_add_watch(
+				reload_fd,
+				(reload_name == reload_dir) ? "." : ((reload_dir[0] == '\0') ? "/" : reload_dir),
+				IN_CLOSE_WRITE | IN_MOVED_TO);
+
+			if (err_watch == -1)
+			{
+				decode_run = 0;
+				dgn_throw(SSHRAM_ERR_DEC_INOTIFY_ADD_WATCH);
+			}
+		}
+	}
+
+	// keep the private key encrypted in memory between transmissions
+	struct sealed sealed = {0};
+	struct sealed* seal = NULL;
+	uint8_t first = buf_decoded[0];
+
+	if ((config->sealed == true) && (decode_run == 1))
+	{
+		int err_mlock = mlock(&sealed, sizeof (sealed));
+
+		if (err_mlock != 0)
+		{
+			decode_run = 0;
+			dgn_throw(SSHRAM_ERR_MLOCK);
+		}
+		else
+		{
+			printf("Sealing private key with an ephemeral key (blocking while gathering entropy)\n");
+			decode_seal(&sealed, &buf_decoded, buf_len);
+			seal = &sealed;
+
+			if (dgn_catch())
+			{
+				decode_run = 0;
+			}
+		}
+	}
+
+	// blocking, no-confirmation key transmission using inotify
+	size_t pipe_max = pipe_max_size();
+	struct timespec time_start;
+	struct timespec time_end;
+	enum delivery delivery;
+	uint32_t mask;
+	bool closed;
+	int pipe = -1;
+	ssize_t err_loop;
+
+	// pre-armed deliveries need the whole private key to fit in the pipe,
+	// which is checked on the first one (kept in lazy for the loop)
+	bool queue = false;
+
+	if ((config->queue == true) && (decode_run == 1))
+	{
+		queue = queue_fits(path, &lazy, buf_len, pipe_max);
+
+		if (dgn_catch())
+		{
+			decode_run = 0;
+		}
+		else if (queue == false)
+		{
+			printf("The private key doesn't fit in the pipe buffer, delivering it without -q\n");
+		}
+	}
+
+	if (decode_run == 1)
+	{
+		printf("Entering transmission loop\n");
+
+		// the loop only queues its messages
+		logring_start(config->syslog);
+
+		if (dgn_catch())
+		{
+			decode_run = 0;
+		}
+	}
+
+	while ((decode_run == 1) && (queue == true))
+	{
+		if (pipe == -1)
+		{
+			pipe = lazy;
+			lazy = -1;
+		}
+
+		queue_arm(path, &pipe, buf_decoded, buf_len, pipe_max);
+
+		if (dgn_catch())
+		{
+			break;
+		}
+
+		queue_deliver(inotify_fd, pipe, inotify_event_buf, inotify_event_buf_size, &time_start);
+		pipe = -1;
+
+		if (dgn_catch())
+		{
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+		logring_push(LOGRING_TRANSMITTED, buf_len, elapsed_ns(&time_start, &time_end));
+	}
+
+	while ((decode_run == 1) && (queue == false))
+	{
+		// the pipe stays armed when the encoded file is reloaded
+		// unless the first character of the private key changed
+		if (pipe == -1)
+		{
+			// we *must* open in read-write mode to get a non-blocking descriptor
+			// because unix pipes must be opened in read or read/write mode first
+			// or we will not be able to open without non-blocking
+			// (the first one may already have been opened by decode_lazy)
+			pipe = (lazy != -1) ? lazy : open(path, O_RDWR | O_NONBLOCK);
+			lazy = -1;
+
+			if (pipe == -1)
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
+				break;
+			}
+
+			// a private key fitting in the pipe buffer is written all at once,
+			// but a sealed one must never be whole in the pipe buffer
+			if (seal != NULL)
+			{
+				pipe_shrink(pipe, SEALED_CHUNK_LEN);
+			}
+			else
+			{
+				pipe_grow(pipe, buf_len, pipe_max);
+			}
+
+			// send the first character of the private key to be able to detect reads
+			err_loop = write(pipe, &first, 1);
+
+			if (err_loop != 1)
+			{
+				dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+				break;
+			}
+		}
+
+		// wait for read, and swap the private key between deliveries
+		if (wait_probe(inotify_fd, reload_fd, inotify_event_buf, inotify_event_buf_size) == false)
+		{
+			if (dgn_catch())
+			{
+				break;
+			}
+
+			if (reload_file(config, reload_fd, reload_name, &derived, &buf_decoded, &buf_len) == false)
+			{
+				continue;
+			}
+
+			if (buf_decoded[0] != first)
+			{
+				first = buf_decoded[0];
+				close(pipe);
+				pipe = -1;
+			}
+
+			if (seal != NULL)
+			{
+				decode_seal(seal, &buf_decoded, buf_len);
+
+				if (dgn_catch())
+				{
+					break;
+				}
+			}
+
+			continue;
+		}
+
+		if (decode_run == 0)
+		{
+			break;
+		}
+
+		// write the rest of the private key
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+		closed = false;
+
+		delivery = pipe_stream(
+			pipe,
+			inotify_fd,
+			inotify_event_buf,
+			inotify_event_buf_size,
+			buf_decoded,
+			seal,
+			1,
+			buf_len,
+			&closed);
+
+		if (seal != NULL)
+		{
+			sealed_wipe(seal);
+		}
+
+		if (delivery == SSHRAM_DELIVERY_ERROR)
+		{
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+		// close pipe to simulate end-of-file
+		err_file = close(pipe);
+		pipe = -1;
+
+		if (err_file == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FCLOSE);
+			break;
+		}
+
+		if (delivery == SSHRAM_DELIVERY_ABORTED)
+		{
+			logring_push(LOGRING_ABORTED, 0, 0);
+			continue;
+		}
+
+		// wait for the reader to get end-of-file before re-opening the pipe
+		while (closed == false)
+		{
+			mask = pipe_events(inotify_fd, inotify_event_buf, inotify_event_buf_size);
+
+			if (dgn_catch())
+			{
+				break;
+			}
+
+			closed = ((mask & IN_CLOSE_NOWRITE) != 0);
+		}
+
+		if (dgn_catch())
+		{
+			break;
+		}
+
+		// success!
+		logring_push(LOGRING_TRANSMITTED, buf_len, elapsed_ns(&time_start, &time_end));
+
+		// cost of keeping the private key sealed
+		if (seal != NULL)
+		{
+			logring_push(LOGRING_SEALED_COST, 0, seal->cost * 1e9);
+			seal->cost = 0;
+		}
+	}
+
+	logring_stop();
+
+	if (config->keep_pipe == false)
+	{
+		err_file = unlink(path);
+
+		if (err_file == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_UNLINK);
+		}
+	}
+
+	// cleanup
+	if (reload_fd != -1)
+	{
+		close(reload_fd);
+	}
+
+	if (seal != NULL)
+	{
+		sealed_free(seal);
+		munlock(seal, sizeof (sealed));
+	}
+
+	if (buf_decoded != NULL)
+	{
+		lockplan_release(buf_decoded, buf_len + 1);
+	}
+
+	inotify_rm_watch(inotify_fd, inotify_watch_fd);
+	close(inotify_fd);
+	mem_clean(&derived, sizeof (derived));
+	munlock(&derived, sizeof (derived));
+	decode_free(inotify_event_buf);
+	free(reload_dir);
+	decode_free(path);
+
+	if (config->verbose == true)
+	{
+		lockplan_report();
+	}
+
+	printf("Exiting normally\n");
+}
+
+// unlock several encoded files at once and serve all their private keys
+void sshram_decode_many(struct config* config)
+{
+	const struct sigaction sig_struct =
+	{
+		.sa_handler = sigint_handler,
+		.sa_flags = 0, // interrupt poll
+	};
+
+	if (sigaction(SIGINT, &sig_struct, NULL) == -1)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_SIGACTION);
+		return;
+	}
+
+	size_t count = config->paths_count;
+
+	// fail before asking for a password if the buffers can't be locked
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct stat file_info;
+
+		if ((stat(config->paths[i], &file_info) == 0) && (file_info.st_size > 0))
+		{
+			lockplan_need(file_info.st_size, false);
+			lockplan_need(file_info.st_size + 1, true);
+		}
+	}
+
+	lockplan_fit(config->verbose);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	struct sshram_options options = config_options(config, NULL);
+	struct sshram_options options_encoded = encoded_options(&options);
+	struct sshram_file* files = calloc(count, sizeof (struct sshram_file));
+	struct serve_pipe* serves = calloc(count, sizeof (struct serve_pipe));
+	size_t* encoded_lens = calloc(count, sizeof (size_t));
+
+	if ((files == NULL) || (serves == NULL) || (encoded_lens == NULL))
+	{
+		free(files);
+		free(serves);
+		free(encoded_lens);
+
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	// read every encoded file in a single batch
+	struct iobatch_req* reqs = calloc(count, sizeof (struct iobatch_req));
+
+	if (reqs == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_MALLOC);
+	}
+
+	for (size_t i = 0; (reqs != NULL) && (i < count); ++i)
+	{
+		reqs[i].fd = -1;
+	}
+
+	for (size_t i = 0; (i < count) && (dgn_catch() == false); ++i)
+	{
+		struct stat file_info;
+
+		reqs[i].fd = open(config->paths[i], O_RDONLY | O_CLOEXEC);
+
+		if (reqs[i].fd == -1)
+		{
+			dgn_throw(SSHRAM_ERR_ARG_ENCODED_OPEN);
+			break;
+		}
+
+		if (fstat(reqs[i].fd, &file_info) != 0)
+		{
+			dgn_throw(SSHRAM_ERR_FSEEK);
+			break;
+		}
+
+		if (file_info.st_size < 2)
+		{
+			dgn_throw(SSHRAM_ERR_FTELL);
+			break;
+		}
+
+		encoded_lens[i] = file_info.st_size;
+		files[i].in = sshram_alloc(&options_encoded, encoded_lens[i]);
+		files[i].len = encoded_lens[i];
+		reqs[i].buf = (uint8_t*) files[i].in;
+		reqs[i].len = encoded_lens[i];
+	}
+
+	if ((dgn_catch() == false) && (iobatch_run(reqs, count) == false))
+	{
+		dgn_throw(SSHRAM_ERR_FREAD);
+	}
+
+	for (size_t i = 0; (reqs != NULL) && (i < count); ++i)
+	{
+		if (reqs[i].fd != -1)
+		{
+			close(reqs[i].fd);
+		}
+	}
+
+	free(reqs);
+
+	struct sshram_pass source = config_pass(config);
+
+	size_t decoded = 0;
+
+	if (dgn_catch() == false)
+	{
+		decoded = sshram_decode_files(files, count, &source, &options);
+	}
+
+	// the encoded files are not needed anymore
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (files[i].in != NULL)
+		{
+			sshram_release(&options_encoded, (uint8_t*) files[i].in, encoded_lens[i]);
+		}
+	}
+
+	free(encoded_lens);
+
+	// keep the private keys which were decoded
+	size_t served = 0;
+
+	for (size_t i = 0; (i < count) && (dgn_catch() == false); ++i)
+	{
+		if (files[i].out == NULL)
+		{
+			printf("FAIL %s: %s\n", config->paths[i], files[i].error);
+			continue;
+		}
+
+		serves[served].buf = files[i].out;
+		serves[served].len = files[i].out_len;
+		serves[served].pipe = -1;
+		serves[served].watch = -1;
+		serves[served].path = (char*) basename(config->paths[i]);
+		++served;
+	}
+
+	if ((dgn_catch() == false) && (decoded == 0))
+	{
+		dgn_throw(SSHRAM_ERR_DEC_CHACHAPOLY);
+	}
+
+	if (dgn_catch() == false)
+	{
+		printf("Unlocked %zu of %zu encoded files\n", decoded, count);
+		decode_compact(config);
+	}
+
+	// serve them from a FUSE filesystem, or from named pipes
+	if ((dgn_catch() == false) && (config->mountpoint != NULL))
+	{
+		struct keyfs_entry* entries = calloc(served, sizeof (struct keyfs_entry));
+
+		if (entries == NULL)
+		{
+			dgn_throw(SSHRAM_ERR_MALLOC);
+		}
+		else
+		{
+			for (size_t i = 0; i < served; ++i)
+			{
+				entries[i].name = serves[i].path;
+				entries[i].buf = serves[i].buf;
+				entries[i].len = serves[i].len;
+			}
+
+			logring_start(config->syslog);
+
+			if (dgn_catch() == false)
+			{
+				keyfs_serve(config->mountpoint, entries, served);
+				logring_stop();
+			}
+
+			free(entries);
+		}
+
+		served = 0;
+	}
+
+	size_t created = 0;
+
+	if (dgn_catch() == false)
+	{
+		serve_create(serves, served, &created);
+	}
+
+	if ((dgn_catch() == false) && (served > 0))
+	{
+		serve_loop(serves, served, config->syslog);
+	}
+
+	// cleanup
+	serve_remove(serves, created, config->keep_pipe);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (files[i].out != NULL)
+		{
+			sshram_release(&options, files[i].out, files[i].out_len + 1);
+		}
+	}
+
+	free(serves);
+	free(files);
+
+	if (dgn_catch() == false)
+	{
+		if (config->verbose == true)
+		{
+			lockplan_report();
+		}
+
+		printf("Exiting normally\n");
+	}
+}
+
+// the benchmark only ever uses this seed, to encode the same bytes on every run
+#define SSHRAM_BENCH_SEED 0x73736872616d2062ull
+#define SSHRAM_BENCH_DELIVERIES 64
+
+struct bench_reader
+{
+	const char* path;
+	size_t len;
+	int count;
+	bool ok;
+	// total time from open() to end-of-file
+	double ms;
+};
+
+// splitmix64, NOT a source of secrets: benchmarks only
+static void bench_random(void* data, uint8_t* out, size_t len)
+{
+	uint64_t* state = (uint64_t*) data;
+	uint64_t z = 0;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		if ((i % 8) == 0)
+		{
+			*state += 0x9e3779b97f4a7c15ull;
+			z = *state;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			z ^= z >> 31;
+		}
+
+		out[i] = z >> (8 * (i % 8));
+	}
+}
+
+// every prompt gets the password read once at startup
+static bool bench_pass(void* data, enum sshram_pass_reason reason, char* pass, size_t size)
+{
+	const char* bench = (const char*) data;
+	size_t len = strlen(bench);
+
+	if (len >= size)
+	{
+		return false;
+	}
+
+	memcpy(pass, bench, len + 1);
+
+	return true;
+}
+
+static double bench_ms(const struct timespec* start, const struct timespec* end)
+{
+	return elapsed_ns(start, end) / 1e6;
+}
+
+// a client reading the named pipe until end-of-file, as SSH does, arriving
+// when the pipe is idle so the wakeups of sshram are part of its latency
+static void* bench_read(void* data)
+{
+	struct bench_reader* reader = (struct bench_reader*) data;
+	const struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000};
+	struct timespec time_start;
+	struct timespec time_end;
+	uint8_t buf[4096];
+	ssize_t len;
+
+	for (int i = 0; i < reader->count; ++i)
+	{
+		nanosleep(&pause, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+		int fd = open(reader->path, O_RDONLY);
+		size_t total = 0;
+
+		if (fd == -1)
+		{
+			reader->ok = false;
+			break;
+		}
+
+		while ((len = read(fd, buf, sizeof (buf))) > 0)
+		{
+			total += len;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+		reader->ms += bench_ms(&time_start, &time_end);
+		close(fd);
+
+		if (total != reader->len)
+		{
+			reader->ok = false;
+		}
+	}
+
+	mem_clean(buf, sizeof (buf));
+
+	return NULL;
+}
+
+// run the same transmission cycle as the decoding loop against a local reader
+void sshram_bench_deliver(const uint8_t* buf, size_t len, bool queue, double* ms)
+{
+	char dir[] = "/tmp/sshram-bench-XXXXXX";
+	char path[sizeof (dir) + 4];
+
+	if (mkdtemp(dir) == NULL)
+	{
+		dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
+		return;
+	}
+
+	snprintf(path, sizeof (path), "%s/key", dir);
+
+	if (mkfifo(path, S_IRUSR | S_IWUSR) != 0)
+	{
+		rmdir(dir);
+		dgn_throw(SSHRAM_ERR_DEC_MKFIFO);
+		return;
+	}
+
+	int inotify_fd = inotify_init();
+
+	if ((inotify_fd == -1)
+		|| (inotify_add_watch(inotify_fd, path, IN_ACCESS | IN_CLOSE_NOWRITE) == -1))
+	{
+		if (inotify_fd != -1)
+		{
+			close(inotify_fd);
+		}
+
+		unlink(path);
+		rmdir(dir);
+		dgn_throw(SSHRAM_ERR_DEC_INOTIFY_INIT);
+		return;
+	}
+
+	size_t events_size = SSHRAM_INOTIFY_EVENTS * (sizeof (struct inotify_event));
+	struct inotify_event* events = malloc(events_size);
+
+	if (events == NULL)
+	{
+		close(inotify_fd);
+		unlink(path);
+		rmdir(dir);
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	struct bench_reader reader =
+	{
+		.path = path,
+		.len = len,
+		.count = SSHRAM_BENCH_DELIVERIES,
+		.ok = true,
+		.ms = 0,
+	};
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, bench_read, &reader) != 0)
+	{
+		free(events);
+		close(inotify_fd);
+		unlink(path);
+		rmdir(dir);
+		dgn_throw(SSHRAM_ERR_BENCH_THREAD);
+		return;
+	}
+
+	size_t pipe_max = pipe_max_size();
+	struct timespec time_start;
+	bool closed;
+	int i;
+
+	for (i = 0; i < SSHRAM_BENCH_DELIVERIES; ++i)
+	{
+		int pipe = -1;
+
+		if (queue == true)
+		{
+			queue_arm(path, &pipe, buf, len, pipe_max);
+
+			if (dgn_catch())
+			{
+				if (pipe != -1)
+				{
+					close(pipe);
+				}
+
+				break;
+			}
+
+			queue_deliver(inotify_fd, pipe, events, events_size, &time_start);
+
+			if (dgn_catch())
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		pipe = open(path, O_RDWR | O_NONBLOCK);
+
+		if (pipe == -1)
+		{
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FOPEN);
+			break;
+		}
+
+		pipe_grow(pipe, len, pipe_max);
+
+		if (write(pipe, buf, 1) != 1)
+		{
+			close(pipe);
+			dgn_throw(SSHRAM_ERR_DEC_PIPE_FWRITE);
+			break;
+		}
+
+		if (wait_probe(inotify_fd, -1, events, events_size) == false)
+		{
+			close(pipe);
+			break;
+		}
+
+		closed = false;
+
+		enum delivery delivery = pipe_stream(
+			pipe,
+			inotify_fd,
+			events,
+			events_size,
+			buf,
+			NULL,
+			1,
+			len,
+			&closed);
+
+		close(pipe);
+
+		if (delivery != SSHRAM_DELIVERY_OK)
+		{
+			break;
+		}
+
+		while ((closed == false) && (dgn_catch() == false))
+		{
+			closed = ((pipe_events(inotify_fd, events, events_size) & IN_CLOSE_NOWRITE) != 0);
+		}
+
+		if (dgn_catch())
+		{
+			break;
+		}
+	}
+
+	// unblock the reader if we stopped early
+	if (i < SSHRAM_BENCH_DELIVERIES)
+	{
+		pthread_cancel(thread);
+	}
+
+	pthread_join(thread, NULL);
+	free(events);
+	close(inotify_fd);
+	unlink(path);
+	rmdir(dir);
+
+	if ((dgn_catch() == false) && (reader.ok == false))
+	{
+		dgn_throw(SSHRAM_ERR_BENCH_MISMATCH);
+	}
+
+	*ms = reader.ms / SSHRAM_BENCH_DELIVERIES;
+}
+
+// raw payload throughput of one AEAD backend, without the key derivation
+static void bench_aead(
+	const struct aead* aead,
+	const uint8_t* buf,
+	size_t len,
+	uint8_t* cipher,
+	uint8_t* plain,
+	int iterations)
+{
+	uint8_t key[32] = {0};
+	uint8_t nonce[12] = {0};
+	uint8_t tag[16];
+	struct timespec time_start;
+	struct timespec time_mid;
+	struct timespec time_end;
+	double encrypt_ms = 0;
+	double decrypt_ms = 0;
+
+	for (int i = 0; i < iterations; ++i)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+		aead->encrypt(key, nonce, NULL, 0, buf, len, cipher, tag);
+		clock_gettime(CLOCK_MONOTONIC, &time_mid);
+
+		if (aead->decrypt(key, nonce, NULL, 0, cipher, len, tag, plain) != 0)
+		{
+			dgn_throw(SSHRAM_ERR_BENCH_MISMATCH);
+			return;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+		encrypt_ms += bench_ms(&time_start, &time_mid);
+		decrypt_ms += bench_ms(&time_mid, &time_end);
+	}
+
+	double mib = ((double) len * iterations) / (1024 * 1024);
+
+	printf(
+		"%-24s %10.1f MiB/s encrypt %10.1f MiB/s decrypt\n",
+		aead->label,
+		mib / (encrypt_ms / 1e3),
+		mib / (decrypt_ms / 1e3));
+}
+
+struct bench
+{
+	struct sshram_options options;
+	struct sshram_pass source;
+	uint64_t state;
+	const uint8_t* buf;
+	size_t len;
+	size_t cap;
+	uint8_t* encoded;
+	uint8_t* reference;
+	uint8_t* plain;
+	int iterations;
+};
+
+// encode and decode the same file, checking every output
+static void bench_run(struct bench* bench)
+{
+	struct timespec time_start;
+	struct timespec time_end;
+	double encode_ms = 0;
+	double decode_ms = 0;
+	size_t encoded_len = 0;
+	size_t decoded_len;
+	uint8_t* decoded;
+	size_t len;
+	bool same;
+
+	for (int i = 0; i < bench->iterations; ++i)
+	{
+		// every iteration must give exactly the same encoded file
+		bench->state = SSHRAM_BENCH_SEED;
+
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+		len = sshram_encode_buf(
+			bench->buf,
+			bench->len,
+			bench->encoded,
+			bench->cap,
+			&(bench->source),
+			&(bench->options));
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+		if (dgn_catch())
+		{
+			return;
+		}
+
+		encode_ms += bench_ms(&time_start, &time_end);
+
+		if (i == 0)
+		{
+			memcpy(bench->reference, bench->encoded, len);
+			encoded_len = len;
+		}
+		else if ((len != encoded_len) || (memcmp(bench->reference, bench->encoded, len) != 0))
+		{
+			dgn_throw(SSHRAM_ERR_BENCH_MISMATCH);
+			return;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &time_start);
+		decoded = sshram_decode_buf(
+			bench->encoded,
+			len,
+			&decoded_len,
+			&(bench->source),
+			&(bench->options));
+		clock_gettime(CLOCK_MONOTONIC, &time_end);
+
+		if (decoded == NULL)
+		{
+			return;
+		}
+
+		decode_ms += bench_ms(&time_start, &time_end);
+		same = (decoded_len == bench->len) && (memcmp(decoded, bench->buf, bench->len) == 0);
+		sshram_release(&(bench->options), decoded, decoded_len + 1);
+
+		if (same == false)
+		{
+			dgn_throw(SSHRAM_ERR_BENCH_MISMATCH);
+			return;
+		}
+	}
+
+	printf("encode   %10.3f ms mean (%zu bytes)\n", encode_ms / bench->iterations, encoded_len);
+	printf("decode   %10.3f ms mean\n", decode_ms / bench->iterations);
+
+	double deliver_ms;
+
+	sshram_bench_deliver(bench->buf, bench->len, false, &deliver_ms);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	printf(
+		"deliver  %10.3f ms mean reader latency (%d simulated pipe transmissions)\n",
+		deliver_ms,
+		SSHRAM_BENCH_DELIVERIES);
+
+	// pre-armed deliveries, only possible if the pipe can hold the whole file
+	if (bench->len <= pipe_max_size())
+	{
+		sshram_bench_deliver(bench->buf, bench->len, true, &deliver_ms);
+
+		if (dgn_catch())
+		{
+			return;
+		}
+
+		printf("queued   %10.3f ms mean reader latency (-q)\n", deliver_ms);
+	}
+
+	// compare the payload ciphers on the same data
+	for (int cipher = 0; cipher < AEAD_CIPHERS; ++cipher)
+	{
+		if (aead_accelerated(cipher) == true)
+		{
+			bench_aead(
+				&aead_aes256gcm_portable,
+				bench->buf,
+				bench->len,
+				bench->encoded,
+				bench->plain,
+				bench->iterations);
+		}
+
+		bench_aead(
+			aead_get(cipher),
+			bench->buf,
+			bench->len,
+			bench->encoded,
+			bench->plain,
+			bench->iterations);
+
+		if (dgn_catch())
+		{
+			return;
+		}
+	}
+}
+
+void sshram_bench(struct config* config)
+{
+	struct bench bench =
+	{
+		.options = config_options(config, NULL),
+		.state = SSHRAM_BENCH_SEED,
+		.iterations = config->bench,
+	};
+
+	struct sshram_random random =
+	{
+		.fill = bench_random,
+		.data = &(bench.state),
+	};
+
+	// only the results are printed, so runs can be compared
+	bench.options.random = &random;
+	bench.options.log = (config->verbose == true) ? stdout : NULL;
+
+	size_t plan_len = file_size(config->file_decoded);
+
+	lockplan_need(plan_len, true);
+	lockplan_need(SSHRAM_PASS_LEN, true);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		lockplan_need(sshram_encode_bound(plan_len), true);
+	}
+
+	lockplan_fit(config->verbose);
+
+	if (dgn_catch())
+	{
+		return;
+	}
+
+	uint8_t* buf = file_read(config->file_decoded, &(bench.options), &(bench.len));
+
+	if (buf == NULL)
+	{
+		return;
+	}
+
+	char* pass = (char*) sshram_alloc(&(bench.options), SSHRAM_PASS_LEN);
+
+	if (pass == NULL)
+	{
+		sshram_release(&(bench.options), buf, bench.len);
+		return;
+	}
+
+	// the password is read only once, from the terminal or with -p
+	printf("Please enter the benchmark password: ");
+	fflush(stdout);
+
+	if (getpassword(pass, SSHRAM_PASS_LEN, config->file_pass) != pass)
+	{
+		sshram_release(&(bench.options), (uint8_t*) pass, SSHRAM_PASS_LEN);
+		sshram_release(&(bench.options), buf, bench.len);
+
+		dgn_throw(SSHRAM_ERR_FGETS);
+		return;
+	}
+
+	if (isatty(fileno(config->file_pass)) == 0)
+	{
+		printf("\n");
+	}
+
+	printf(
+		"Benchmarking %d iterations on %zu bytes with %s (salts and nonces are NOT random)\n",
+		config->bench,
+		bench.len,
+		aead_get(config->cipher)->label);
+
+	bench.source.get = bench_pass;
+	bench.source.data = pass;
+	bench.buf = buf;
+	bench.cap = sshram_encode_bound(bench.len);
+	bench.encoded = sshram_alloc(&(bench.options), bench.cap);
+	bench.reference = sshram_alloc(&(bench.options), bench.cap);
+	bench.plain = sshram_alloc(&(bench.options), bench.cap);
+
+	if ((bench.encoded != NULL) && (bench.reference != NULL) && (bench.plain != NULL))
+	{
+		bench_run(&bench);
+	}
+
+	if (bench.plain != NULL)
+	{
+		sshram_release(&(bench.options), bench.plain, bench.cap);
+	}
+
+	if (bench.reference != NULL)
+	{
+		sshram_release(&(bench.options), bench.reference, bench.cap);
+	}
+
+	if (bench.encoded != NULL)
+	{
+		sshram_release(&(bench.options), bench.encoded, bench.cap);
+	}
+
+	sshram_release(&(bench.options), (uint8_t*) pass, SSHRAM_PASS_LEN);
+	sshram_release(&(bench.options), buf, bench.len);
 }
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // structs
 enum action
@@ -10,6 +11,10 @@ enum action
 	SSHRAM_ACTION_EXIT,
 	SSHRAM_ACTION_DECODE,
 	SSHRAM_ACTION_ENCODE,
+	SSHRAM_ACTION_REKEY,
+	SSHRAM_ACTION_ADD_SLOT,
+	SSHRAM_ACTION_VERIFY,
+	SSHRAM_ACTION_BENCH,
 };
 
 struct config
@@ -17,13 +22,44 @@ struct config
 	enum action action;
 	FILE* file_encoded;
 	FILE* file_decoded;
+	FILE* file_pass;
+	char* path_encoded;
 	char* key_name;
+	char** names;
+	int names_count;
+	char* mountpoint;
+	char* socket;
+	char* askpass;
+	char** media;
+	int media_count;
+	char** verify_paths;
+	int verify_count;
+	char** paths;
+	int paths_count;
+	int bench;
+	int slot;
+	int jobs;
+	int cipher;
+	bool compress;
 	bool keep_pipe;
+	bool lazy;
+	bool queue;
+	bool sealed;
 	bool verbose;
+	bool watch;
+	bool syslog;
 };
 
 // functions
+char* getpassword(char* s, int size, FILE* stream);
 void sshram_encode(struct config* config);
 void sshram_decode(struct config* config);
+void sshram_decode_many(struct config* config);
+void sshram_rekey(struct config* config);
+void sshram_verify(struct config* config);
+void sshram_bench(struct config* config);
+// mean latency of a reader getting a private key through a named pipe,
+// delivered with a probe byte or pre-armed (see -q)
+void sshram_bench_deliver(const uint8_t* buf, size_t len, bool queue, double* ms);
 
 #endif
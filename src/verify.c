@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include "dragonfail.h"
+#include "iobatch.h"
+#include "libsshram.h"
+#include "sshram.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VERIFY_EXTENSION ".chachapoly"
+#define VERIFY_LEGACY_HEADER_LEN (16 + 12 + 16)
+
+struct verify_file
+{
+	char* path;
+	uint8_t* buf;
+	size_t len;
+	const char* error;
+	double elapsed;
+};
+
+struct verify
+{
+	struct verify_file* files;
+	size_t files_count;
+};
+
+// a single password is checked against every file
+struct verify_pass
+{
+	FILE* file;
+	bool asked;
+	bool failed;
+};
+
+static double verify_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+static int verify_cmp(const void* a, const void* b)
+{
+	return strcmp(
+		((const struct verify_file*) a)->path,
+		((const struct verify_file*) b)->path);
+}
+
+static bool verify_add(struct verify* verify, const char* path)
+{
+	struct verify_file* files = realloc(
+		verify->files,
+		(verify->files_count + 1) * (sizeof (struct verify_file)));
+
+	if (files == NULL)
+	{
+		return false;
+	}
+
+	verify->files = files;
+	memset(&(files[verify->files_count]), 0, sizeof (struct verify_file));
+	files[verify->files_count].path = strdup(path);
+
+	if (files[verify->files_count].path == NULL)
+	{
+		return false;
+	}
+
+	++(verify->files_count);
+
+	return true;
+}
+
+// directories are searched for encoded files, without recursion
+static bool verify_collect(struct verify* verify, const char* path)
+{
+	struct stat file_info;
+
+	if ((stat(path, &file_info) != 0) || (S_ISDIR(file_info.st_mode) == 0))
+	{
+		return verify_add(verify, path);
+	}
+
+	DIR* dir = opendir(path);
+
+	if (dir == NULL)
+	{
+		return verify_add(verify, path);
+	}
+
+	struct dirent* entry;
+	size_t ext_len = strlen(VERIFY_EXTENSION);
+	bool ok = true;
+
+	while ((ok == true) && ((entry = readdir(dir)) != NULL))
+	{
+		size_t name_len = strlen(entry->d_name);
+
+		if ((name_len <= ext_len)
+			|| (strcmp(entry->d_name + name_len - ext_len, VERIFY_EXTENSION) != 0))
+		{
+			continue;
+		}
+
+		char* full = NULL;
+
+		if (asprintf(&full, "%s/%s", path, entry->d_name) == -1)
+		{
+			ok = false;
+			break;
+		}
+
+		ok = verify_add(verify, full);
+		free(full);
+	}
+
+	closedir(dir);
+
+	return ok;
+}
+
+// open the file and allocate its buffer, it is read along with all the others
+static bool verify_open(struct verify_file* file, struct iobatch_req* req)
+{
+	struct stat file_info;
+
+	req->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+
+	if (req->fd == -1)
+	{
+		file->error = "couldn't open file";
+		return true;
+	}
+
+	if ((fstat(req->fd, &file_info) != 0) || (file_info.st_size <= VERIFY_LEGACY_HEADER_LEN))
+	{
+		close(req->fd);
+		req->fd = -1;
+		file->error = "file too short";
+		return true;
+	}
+
+	file->buf = malloc(file_info.st_size);
+
+	if (file->buf == NULL)
+	{
+		close(req->fd);
+		req->fd = -1;
+		return false;
+	}
+
+	req->buf = file->buf;
+	req->len = file_info.st_size;
+
+	return true;
+}
+
+static bool verify_pass_get(void* data, enum sshram_pass_reason reason, char* pass, size_t size)
+{
+	struct verify_pass* source = (struct verify_pass*) data;
+
+	if (source->asked == true)
+	{
+		return false;
+	}
+
+	source->asked = true;
+	printf("Please enter your password: ");
+	fflush(stdout);
+
+	source->failed = (getpassword(pass, size, source->file) != pass);
+
+	return source->failed == false;
+}
+
+// the decoded buffers are wiped right away, locking them is only best-effort
+static uint8_t* verify_alloc(void* data, size_t len)
+{
+	uint8_t* buf = calloc(len, 1);
+
+	if (buf != NULL)
+	{
+		mlock(buf, len);
+	}
+
+	return buf;
+}
+
+static void verify_release(void* data, uint8_t* buf, size_t len)
+{
+	munlock(buf, len);
+	free(buf);
+}
+
+static const struct sshram_alloc verify_allocator =
+{
+	.alloc = verify_alloc,
+	.release = verify_release,
+	.data = NULL,
+};
+
+static void verify_free(struct verify* verify)
+{
+	for (size_t i = 0; i < verify->files_count; ++i)
+	{
+		free(verify->files[i].path);
+		free(verify->files[i].buf);
+	}
+
+	free(verify->files);
+}
+
+// check the integrity of many encoded files with a single password,
+// without decoding them to pipes
+void sshram_verify(struct config* config)
+{
+	struct verify verify = {0};
+
+	for (int i = 0; i < config->verify_count; ++i)
+	{
+		if (verify_collect(&verify, config->verify_paths[i]) == false)
+		{
+			verify_free(&verify);
+			dgn_throw(SSHRAM_ERR_MALLOC);
+			return;
+		}
+	}
+
+	if (verify.files_count == 0)
+	{
+		dgn_throw(SSHRAM_ERR_VERIFY_EMPTY);
+		return;
+	}
+
+	qsort(verify.files, verify.files_count, sizeof (struct verify_file), verify_cmp);
+
+	// read all the files at once, unopened ones get an empty request
+	struct iobatch_req* reqs = calloc(verify.files_count, sizeof (struct iobatch_req));
+	bool ok = (reqs != NULL);
+
+	for (size_t i = 0; (ok == true) && (i < verify.files_count); ++i)
+	{
+		reqs[i].fd = -1;
+		ok = verify_open(&(verify.files[i]), &(reqs[i]));
+	}
+
+	if (ok == true)
+	{
+		iobatch_run(reqs, verify.files_count);
+	}
+
+	for (size_t i = 0; (reqs != NULL) && (i < verify.files_count); ++i)
+	{
+		struct verify_file* file = &(verify.files[i]);
+
+		if (reqs[i].fd == -1)
+		{
+			continue;
+		}
+
+		close(reqs[i].fd);
+		file->len = reqs[i].done;
+
+		if ((ok == false) || (file->error != NULL))
+		{
+			continue;
+		}
+
+		if ((reqs[i].error != 0) || (reqs[i].done != reqs[i].len))
+		{
+			file->error = "couldn't read file";
+		}
+	}
+
+	free(reqs);
+
+	if (ok == false)
+	{
+		verify_free(&verify);
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	// the files which could be read are decoded as a batch, by the library
+	struct sshram_file* batch = calloc(verify.files_count, sizeof (struct sshram_file));
+	size_t* batch_files = calloc(verify.files_count, sizeof (size_t));
+	size_t batch_count = 0;
+
+	if ((batch == NULL) || (batch_files == NULL))
+	{
+		free(batch);
+		free(batch_files);
+		verify_free(&verify);
+		dgn_throw(SSHRAM_ERR_MALLOC);
+		return;
+	}
+
+	for (size_t i = 0; i < verify.files_count; ++i)
+	{
+		if (verify.files[i].error == NULL)
+		{
+			batch[batch_count].in = verify.files[i].buf;
+			batch[batch_count].len = verify.files[i].len;
+			batch_files[batch_count] = i;
+			++batch_count;
+		}
+	}
+
+	struct verify_pass pass = {.file = config->file_pass};
+	struct sshram_pass source = {.get = verify_pass_get, .data = &pass};
+
+	struct sshram_options options =
+	{
+		.alloc = &verify_allocator,
+		.log = stdout,
+		.slot = config->slot,
+		.jobs = config->jobs,
+	};
+
+	printf("Checking %zu files...\n", verify.files_count);
+
+	double start = verify_now();
+
+	if (batch_count > 0)
+	{
+		sshram_decode_files(batch, batch_count, &source, &options);
+	}
+
+	double checked = verify_now();
+
+	for (size_t i = 0; i < batch_count; ++i)
+	{
+		struct verify_file* file = &(verify.files[batch_files[i]]);
+
+		file->error = batch[i].error;
+		file->elapsed = batch[i].elapsed * 1e3;
+
+		if (batch[i].out != NULL)
+		{
+			sshram_release(&options, batch[i].out, batch[i].out_len + 1);
+		}
+	}
+
+	free(batch);
+	free(batch_files);
+
+	if (pass.failed == true)
+	{
+		verify_free(&verify);
+		dgn_throw(SSHRAM_ERR_FGETS);
+		return;
+	}
+
+	if (dgn_catch())
+	{
+		verify_free(&verify);
+		return;
+	}
+
+	// report
+	size_t failed = 0;
+
+	for (size_t i = 0; i < verify.files_count; ++i)
+	{
+		struct verify_file* file = &(verify.files[i]);
+
+		if (file->error == NULL)
+		{
+			printf("PASS %s (%.3f ms)\n", file->path, file->elapsed);
+		}
+		else
+		{
+			printf("FAIL %s: %s (%.3f ms)\n", file->path, file->error, file->elapsed);
+			++failed;
+		}
+	}
+
+	printf(
+		"%zu files, %zu passed, %zu failed (%.3f ms)\n",
+		verify.files_count,
+		verify.files_count - failed,
+		failed,
+		checked - start);
+
+	verify_free(&verify);
+
+	if (failed > 0)
+	{
+		dgn_throw(SSHRAM_ERR_VERIFY_FAILED);
+	}
+}
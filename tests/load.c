@@ -0,0 +1,663 @@
+#define _GNU_SOURCE
+
+#include "argoat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// end-to-end load generator for the named pipe serving loop:
+// encodes a random test key, starts sshram on it without a terminal
+// and spawns concurrent readers opening and reading the pipe in loops
+
+#define ARG_COUNT 17
+#define LOAD_PASS "sshram load generator password"
+#define LOAD_PASS_FD 3
+#define LOAD_KEY "load_key"
+
+struct load
+{
+	char* binary;
+	long readers;
+	long deliveries;
+	long think;
+	long size;
+	long timeout;
+	bool sealed;
+	bool queue;
+	bool verbose;
+};
+
+enum outcome
+{
+	LOAD_OK = 0,
+	LOAD_SHORT,
+	LOAD_CORRUPTED,
+	LOAD_TIMEOUT,
+};
+
+// shared between the reader processes
+struct sample
+{
+	double latency;
+	enum outcome outcome;
+};
+
+// arguments handling
+static void arg_long(long* val, char** pars, const int pars_count)
+{
+	char* end;
+
+	if (pars_count != 1)
+	{
+		return;
+	}
+
+	long tmp = strtol(pars[0], &end, 10);
+
+	if ((*end == '\0') && (tmp >= 0))
+	{
+		*val = tmp;
+	}
+}
+
+void arg_unflagged(void* data, char** pars, const int pars_count)
+{
+}
+
+void arg_binary(void* data, char** pars, const int pars_count)
+{
+	if (pars_count == 1)
+	{
+		((struct load*) data)->binary = pars[0];
+	}
+}
+
+void arg_readers(void* data, char** pars, const int pars_count)
+{
+	arg_long(&(((struct load*) data)->readers), pars, pars_count);
+}
+
+void arg_deliveries(void* data, char** pars, const int pars_count)
+{
+	arg_long(&(((struct load*) data)->deliveries), pars, pars_count);
+}
+
+void arg_think(void* data, char** pars, const int pars_count)
+{
+	arg_long(&(((struct load*) data)->think), pars, pars_count);
+}
+
+void arg_size(void* data, char** pars, const int pars_count)
+{
+	arg_long(&(((struct load*) data)->size), pars, pars_count);
+}
+
+void arg_timeout(void* data, char** pars, const int pars_count)
+{
+	arg_long(&(((struct load*) data)->timeout), pars, pars_count);
+}
+
+void arg_sealed(void* data, char** pars, const int pars_count)
+{
+	((struct load*) data)->sealed = true;
+}
+
+void arg_queue(void* data, char** pars, const int pars_count)
+{
+	((struct load*) data)->queue = true;
+}
+
+void arg_verbose(void* data, char** pars, const int pars_count)
+{
+	((struct load*) data)->verbose = true;
+}
+
+void arg_help(void* data, char** pars, const int pars_count)
+{
+	printf(
+		"usage: load [options]\n"
+		"\n"
+		"    -b [path]   sshram binary to test (default ./sshram)\n"
+		"    -c [count]  concurrent reader processes (default 10)\n"
+		"    -n [count]  deliveries per reader (default 100)\n"
+		"    -t [usecs]  think time between two reads (default 0)\n"
+		"    -s [bytes]  size of the test key (default 400)\n"
+		"    -o [secs]   timeout of a single delivery (default 10)\n"
+		"    -x          serve a sealed private key and report the decryption cost\n"
+		"    -q          serve the private key pre-armed in the pipe (see sshram -q)\n"
+		"    -v          print the sshram output when done\n"
+		"\n"
+		"Exits with a non-zero status if any delivery failed.\n");
+
+	exit(0);
+}
+
+// helpers
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *((const double*) a);
+	double y = *((const double*) b);
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, long count, double p)
+{
+	if (count == 0)
+	{
+		return 0.0;
+	}
+
+	long i = (long) (p * (count - 1) + 0.5);
+
+	return sorted[i];
+}
+
+static bool write_all(int fd, const char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t size = write(fd, buf, len);
+
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		buf += size;
+		len -= size;
+	}
+
+	return true;
+}
+
+// runs sshram with a password pipe on LOAD_PASS_FD
+static pid_t spawn(char* const argv[], const char* pass, int count, int out)
+{
+	int fds[2];
+
+	if (pipe(fds) != 0)
+	{
+		return -1;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		close(fds[1]);
+
+		// the output may be on the password descriptor
+		if (out >= 0)
+		{
+			dup2(out, STDOUT_FILENO);
+			dup2(out, STDERR_FILENO);
+		}
+
+		dup2(fds[0], LOAD_PASS_FD);
+
+		if (fds[0] != LOAD_PASS_FD)
+		{
+			close(fds[0]);
+		}
+
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(fds[0]);
+
+	for (int i = 0; (pid > 0) && (i < count); ++i)
+	{
+		write_all(fds[1], pass, strlen(pass));
+		write_all(fds[1], "\n", 1);
+	}
+
+	close(fds[1]);
+
+	return pid;
+}
+
+static void alarm_handler(int sig)
+{
+}
+
+// open the pipe, read it until EOF and compare with the reference
+static enum outcome deliver(
+	const char* path,
+	const char* key,
+	size_t len,
+	char* buf,
+	long timeout)
+{
+	enum outcome outcome = LOAD_OK;
+	size_t total = 0;
+
+	alarm(timeout);
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		alarm(0);
+		return LOAD_TIMEOUT;
+	}
+
+	while (true)
+	{
+		ssize_t size = read(fd, buf + total, len + 1 - total);
+
+		if (size < 0)
+		{
+			outcome = LOAD_TIMEOUT;
+			break;
+		}
+
+		if (size == 0)
+		{
+			break;
+		}
+
+		total += size;
+
+		// more bytes than the key
+		if (total > len)
+		{
+			outcome = LOAD_CORRUPTED;
+			break;
+		}
+	}
+
+	alarm(0);
+	close(fd);
+
+	if (outcome != LOAD_OK)
+	{
+		return outcome;
+	}
+
+	if (total < len)
+	{
+		return LOAD_SHORT;
+	}
+
+	if (memcmp(buf, key, len) != 0)
+	{
+		return LOAD_CORRUPTED;
+	}
+
+	return LOAD_OK;
+}
+
+static void reader(
+	struct load* load,
+	const char* path,
+	const char* key,
+	struct sample* samples)
+{
+	char* buf = malloc(load->size + 1);
+
+	if (buf == NULL)
+	{
+		_exit(1);
+	}
+
+	// interrupt blocking calls when a delivery takes too long
+	struct sigaction action = {0};
+	action.sa_handler = alarm_handler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+
+	for (long i = 0; i < load->deliveries; ++i)
+	{
+		double start = now();
+
+		samples[i].outcome = deliver(path, key, load->size, buf, load->timeout);
+		samples[i].latency = now() - start;
+
+		if (load->think > 0)
+		{
+			usleep(load->think);
+		}
+	}
+
+	free(buf);
+	_exit(0);
+}
+
+int main(int argc, char** argv)
+{
+	struct load load =
+	{
+		.binary = "./sshram",
+		.readers = 10,
+		.deliveries = 100,
+		.think = 0,
+		.size = 400,
+		.timeout = 10,
+		.sealed = false,
+		.queue = false,
+		.verbose = false,
+	};
+
+	char* unflagged;
+
+	struct argoat_sprig sprigs[ARG_COUNT] =
+	{
+		{NULL, 0, NULL,  arg_unflagged},
+		{"b",  1, &load, arg_binary},
+		{"c",  1, &load, arg_readers},
+		{"n",  1, &load, arg_deliveries},
+		{"t",  1, &load, arg_think},
+		{"s",  1, &load, arg_size},
+		{"o",  1, &load, arg_timeout},
+		{"x",  0, &load, arg_sealed},
+		{"q",  0, &load, arg_queue},
+		{"v",  0, &load, arg_verbose},
+		{"h",  0, NULL,  arg_help},
+		{"help", 0, NULL, arg_help},
+		{"readers", 1, &load, arg_readers},
+		{"deliveries", 1, &load, arg_deliveries},
+		{"think", 1, &load, arg_think},
+		{"sealed", 0, &load, arg_sealed},
+		{"queue", 0, &load, arg_queue},
+	};
+
+	struct argoat args =
+	{
+		sprigs,
+		ARG_COUNT,
+		&unflagged,
+		0,
+		0,
+	};
+
+	argoat_graze(&args, argc, argv);
+
+	if ((load.readers < 1) || (load.deliveries < 1) || (load.size < 1))
+	{
+		fprintf(stderr, "invalid load parameters\n");
+		return 1;
+	}
+
+	// private home directory holding the test key and the pipe
+	char home[] = "/tmp/sshram-load-XXXXXX";
+	char path_ssh[64];
+	char path_key[128];
+	char path_encoded[128];
+	char path_pipe[128];
+	char path_log[128];
+	char binary[PATH_MAX];
+
+	if (realpath(load.binary, binary) == NULL)
+	{
+		fprintf(stderr, "could not find %s\n", load.binary);
+		return 1;
+	}
+
+	if (mkdtemp(home) == NULL)
+	{
+		fprintf(stderr, "could not create a temporary home\n");
+		return 1;
+	}
+
+	snprintf(path_ssh, sizeof (path_ssh), "%s/.ssh", home);
+	snprintf(path_key, sizeof (path_key), "%s/key", home);
+	snprintf(path_encoded, sizeof (path_encoded), "%s/key.chachapoly", home);
+	snprintf(path_pipe, sizeof (path_pipe), "%s/%s", path_ssh, LOAD_KEY);
+	snprintf(path_log, sizeof (path_log), "%s/sshram.log", home);
+	mkdir(path_ssh, 0700);
+	setenv("HOME", home, 1);
+
+	// printable random key, like an OpenSSH one
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char* key = malloc(load.size);
+	int fd_random = open("/dev/urandom", O_RDONLY);
+
+	if ((key == NULL)
+		|| (fd_random < 0)
+		|| (read(fd_random, key, load.size) != load.size))
+	{
+		fprintf(stderr, "could not generate the test key\n");
+		return 1;
+	}
+
+	close(fd_random);
+
+	for (long i = 0; i < load.size; ++i)
+	{
+		key[i] = ((i % 71) == 70) ? '\n' : alphabet[((uint8_t) key[i]) % 64];
+	}
+
+	FILE* file_key = fopen(path_key, "w");
+
+	if ((file_key == NULL) || (fwrite(key, 1, load.size, file_key) != (size_t) load.size))
+	{
+		fprintf(stderr, "could not write the test key\n");
+		return 1;
+	}
+
+	fclose(file_key);
+
+	int log = open(path_log, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	int status;
+
+	// encode it
+	char* argv_encode[] =
+		{binary, "-p", "3", "-e", path_key, path_encoded, NULL};
+
+	pid_t pid = spawn(argv_encode, LOAD_PASS, 2, log);
+
+	if ((pid < 0)
+		|| (waitpid(pid, &status, 0) != pid)
+		|| (WIFEXITED(status) == 0)
+		|| (WEXITSTATUS(status) != 0))
+	{
+		fprintf(stderr, "could not encode the test key (see %s)\n", path_log);
+		return 1;
+	}
+
+	unlink(path_key);
+
+	// serve it
+	char* argv_decode[] =
+		{binary, "-p", "3", "-n", LOAD_KEY, path_encoded, NULL, NULL, NULL};
+
+	int argc_decode = 6;
+
+	if (load.sealed == true)
+	{
+		argv_decode[argc_decode] = "-x";
+		++argc_decode;
+	}
+
+	if (load.queue == true)
+	{
+		argv_decode[argc_decode] = "-q";
+		++argc_decode;
+	}
+
+	printf("Deriving the key (this takes a few seconds)\n");
+	fflush(stdout);
+
+	pid = spawn(argv_decode, LOAD_PASS, 1, log);
+
+	if (pid < 0)
+	{
+		fprintf(stderr, "could not start sshram\n");
+		return 1;
+	}
+
+	struct stat st;
+	double deadline = now() + (load.timeout * 1000.0) + 60000.0;
+
+	while ((stat(path_pipe, &st) != 0) || (S_ISFIFO(st.st_mode) == 0))
+	{
+		if ((waitpid(pid, &status, WNOHANG) == pid) || (now() > deadline))
+		{
+			fprintf(stderr, "sshram did not create its pipe (see %s)\n", path_log);
+			kill(pid, SIGKILL);
+			return 1;
+		}
+
+		usleep(10000);
+	}
+
+	// readers record into shared memory
+	long total = load.readers * load.deliveries;
+
+	struct sample* samples = mmap(
+		NULL,
+		total * sizeof (struct sample),
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS,
+		-1,
+		0);
+
+	if (samples == MAP_FAILED)
+	{
+		fprintf(stderr, "could not map the samples\n");
+		kill(pid, SIGINT);
+		return 1;
+	}
+
+	printf(
+		"Running %ld readers, %ld deliveries each, %ld bytes key, %ld us think time\n",
+		load.readers,
+		load.deliveries,
+		load.size,
+		load.think);
+	fflush(stdout);
+
+	double start = now();
+
+	for (long i = 0; i < load.readers; ++i)
+	{
+		if (fork() == 0)
+		{
+			reader(&load, path_pipe, key, samples + (i * load.deliveries));
+		}
+	}
+
+	for (long i = 0; i < load.readers; ++i)
+	{
+		wait(NULL);
+	}
+
+	double elapsed = now() - start;
+
+	// stop sshram, it removes its pipe
+	kill(pid, SIGINT);
+	waitpid(pid, &status, 0);
+
+	// report
+	double* latencies = malloc(total * sizeof (double));
+	long outcomes[LOAD_TIMEOUT + 1] = {0};
+	long passed = 0;
+
+	for (long i = 0; i < total; ++i)
+	{
+		++(outcomes[samples[i].outcome]);
+
+		if (samples[i].outcome == LOAD_OK)
+		{
+			latencies[passed] = samples[i].latency;
+			++passed;
+		}
+	}
+
+	long failed = total - passed;
+
+	qsort(latencies, passed, sizeof (double), cmp_double);
+
+	printf(
+		"%ld deliveries in %.3f s: %.1f deliveries/s\n"
+		"latency p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n"
+		"%ld failed: %ld incomplete, %ld corrupted, %ld timed out\n",
+		passed,
+		elapsed / 1000.0,
+		passed / (elapsed / 1000.0),
+		percentile(latencies, passed, 0.50),
+		percentile(latencies, passed, 0.99),
+		percentile(latencies, passed, 0.999),
+		(passed > 0) ? latencies[passed - 1] : 0.0,
+		failed,
+		outcomes[LOAD_SHORT],
+		outcomes[LOAD_CORRUPTED],
+		outcomes[LOAD_TIMEOUT]);
+
+	// go through the sshram output
+	char line[256];
+	double cost;
+	double cost_total = 0.0;
+	long cost_count = 0;
+	FILE* file_log = fopen(path_log, "r");
+
+	while ((file_log != NULL) && (fgets(line, sizeof (line), file_log) != NULL))
+	{
+		char* cur = strstr(line, "Sealed private key decrypted in");
+
+		if ((cur != NULL) && (sscanf(cur, "Sealed private key decrypted in %lf ms", &cost) == 1))
+		{
+			cost_total += cost;
+			++cost_count;
+		}
+
+		if (load.verbose == true)
+		{
+			fputs(line, stdout);
+		}
+	}
+
+	if (file_log != NULL)
+	{
+		fclose(file_log);
+	}
+
+	if (cost_count > 0)
+	{
+		printf(
+			"sealed private key decryption: %.3f ms per delivery\n",
+			cost_total / cost_count);
+	}
+
+	close(log);
+	unlink(path_log);
+	unlink(path_encoded);
+	unlink(path_pipe);
+	rmdir(path_ssh);
+	rmdir(home);
+
+	munmap(samples, total * sizeof (struct sample));
+	free(latencies);
+	free(key);
+
+	return (failed > 0) ? 1 : 0;
+}